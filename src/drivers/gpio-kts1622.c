@@ -8,25 +8,51 @@
  */
 
 #include <linux/bits.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/freezer.h>
 #include <linux/gpio/driver.h>
 #include <linux/gpio/consumer.h>
+#include <linux/gpio/machine.h>
 #include <linux/i2c.h>
 #include <linux/init.h>
+#include <linux/input.h>
+#include <linux/input/matrix_keypad.h>
 #include <linux/interrupt.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/miscdevice.h>
 #include <linux/module.h>
+#include <linux/of.h>
 #include <linux/of_platform.h>
+#include <linux/pm_runtime.h>
+#include <linux/property.h>
+#include <linux/pwm.h>
 #include <linux/regmap.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/timer.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include <asm/unaligned.h>
 
 #include <../drivers/gpio/gpiolib.h>
 
-/* KTS1622 definition */
+#include "kts1622.h"
+
+/* KTS1622 family definition, maxima over all variants in the chip-info table */
 #define NUM_PINS					(16)
 #define NUM_PORTS					(2)
 #define NUM_PINS_PER_PORT			(8)
 
+/* Chip-info feature flags, for the blocks a variant may lack */
+#define KTS1622_FEAT_INPUT_LATCH	BIT(0)
+
 /* Pin configuration */
 #define PIN_OUTPUT					(0)
 #define PIN_INPUT					(1)
@@ -36,6 +62,36 @@
 #define PULL_DOWN					(0)
 #define PULL_UP						(1)
 
+/* Output drive strength, two bits per pin in steps of a quarter of full drive */
+#define DRIVE_STRENGTH_FULL			(3)
+#define DRIVE_STRENGTH_MASK			(3)
+#define DRIVE_STRENGTH_FULL_MA		(10)	/* Output current at full drive */
+
+/* Error handling defaults, all adjustable from DT and debugfs */
+#define KTS1622_XFER_RETRIES		(2)	/* Extra attempts per transfer */
+#define KTS1622_XFER_BUDGET_US		(1000)	/* No retry started after this */
+#define KTS1622_RECOVER_AFTER		(3)	/* Failed transfers in a row */
+
+/* Power management */
+#define KTS1622_AUTOSUSPEND_DELAY_MS	(1000)
+
+/* Chips serviced by one handler on a wired-OR interrupt */
+#define KTS1622_IRQ_GROUP_MAX		(8)
+
+/* Input-to-output rules evaluated in the interrupt handler */
+#define KTS1622_REFLEX_MAX		(8)
+
+/* Input polling of pattern waiters on chips without an interrupt */
+#define KTS1622_PATTERN_POLL_MS		(10)
+
+/* Chips behind one aggregated gpio_chip, this one included */
+#define KTS1622_AGGREGATE_MAX		(8)
+
+/* Software PWM engine */
+#define KTS1622_PWM_MIN_PERIOD_NS	(10 * NSEC_PER_MSEC)
+#define KTS1622_PWM_STEPS			(64)	/* Duty resolution per period */
+#define KTS1622_PWM_SLACK_NS		(50 * NSEC_PER_USEC)
+
 /* Registers */
 #define KTS1622_INPUT_0				(0x00)
 #define KTS1622_INPUT_1				(0x01)
@@ -73,504 +129,4896 @@
 #define KTS1622_INDIVIDUAL_PIN_OUTPUT_0	(0x58)
 #define KTS1622_INDIVIDUAL_PIN_OUTPUT_1	(0x59)
 #define KTS1622_SWITCH_DEBOUNCE_ENABLE	(0x5A)
+#define KTS1622_NUM_REGS			(0x5B)
+
+/* Transfer paths, in order of preference for multi-register accesses */
+#define KTS1622_XFER_BYTE			(0)	/* One SMBus byte access per register */
+#define KTS1622_XFER_SMBUS_WORD		(1)	/* Port pairs only */
+#define KTS1622_XFER_SMBUS_BLOCK	(2)
+#define KTS1622_XFER_RAW			(3)	/* Plain I2C messages */
+#define KTS1622_XFER_NUM			(4)
+#define KTS1622_XFER_BENCH_LOOPS	(4)
+
+/* Reset */
+#define KTS1622_GENERAL_CALL_RESET	(0x06)
+#define KTS1622_RESET_PULSE_US		(10)
+#define KTS1622_RESET_RECOVERY_US	(10)
+
+/* Power-on values of the writable registers */
+static const u8 kts1622_reg_defaults[KTS1622_NUM_REGS] = {
+	[KTS1622_OUTPUT_0]			= 0xFF,
+	[KTS1622_OUTPUT_1]			= 0xFF,
+	[KTS1622_CONFIG_0]			= 0xFF,
+	[KTS1622_CONFIG_1]			= 0xFF,
+	[KTS1622_DRIVE_STRENGTH_0A]		= 0xFF,
+	[KTS1622_DRIVE_STRENGTH_0B]		= 0xFF,
+	[KTS1622_DRIVE_STRENGTH_1A]		= 0xFF,
+	[KTS1622_DRIVE_STRENGTH_1B]		= 0xFF,
+	[KTS1622_PULLUP_DOWN_SELECTION_0]	= 0xFF,
+	[KTS1622_PULLUP_DOWN_SELECTION_1]	= 0xFF,
+	[KTS1622_INTERRUPT_MASK_0]		= 0xFF,
+	[KTS1622_INTERRUPT_MASK_1]		= 0xFF,
+};
+
+/*
+ * Contiguous runs of writable registers, each restorable in one block write.
+ * OUTPUT/CONFIG go last so lines only start driving once the output stage,
+ * pulls and drive strength are set up.
+ */
+static const struct {
+	u8 first;
+	u8 last;
+} kts1622_reg_ranges[] = {
+	{ KTS1622_DRIVE_STRENGTH_0A, KTS1622_INTERRUPT_MASK_1 },
+	{ KTS1622_OUTPUT_PORT_CONFIG, KTS1622_INTERRUPT_EDGE_1B },
+	{ KTS1622_INDIVIDUAL_PIN_OUTPUT_0, KTS1622_SWITCH_DEBOUNCE_ENABLE },
+	{ KTS1622_OUTPUT_0, KTS1622_CONFIG_1 },
+};
+
+/*
+ * Per-variant description. All members share the KTS1622 register map, with
+ * per-port registers at <port 0 address> + port (two bytes per port for the
+ * drive strength and interrupt edge banks); narrower variants use fewer ports.
+ */
+struct kts1622_chip_info {
+	const char *name;
+	u8 nports;
+	u32 flags;
+};
+
+enum kts1622_variant {
+	KTS1622,
+};
+
+static const struct kts1622_chip_info kts1622_chip_info_table[] = {
+	[KTS1622] = {
+		.name = "kts1622",
+		.nports = 2,
+		.flags = KTS1622_FEAT_INPUT_LATCH,
+	},
+};
 
 static const struct i2c_device_id kts1622_id[] = {
-	{ "kts1622", 0 },
+	{ "kts1622", KTS1622 },
 	{ }
 };
 MODULE_DEVICE_TABLE(i2c, kts1622_id);
 
+struct kts1622_pwm {
+	struct pwm_chip chip;
+	bool registered;
+	struct task_struct *thread;	/* Started on the first enable */
+	wait_queue_head_t wait;
+	struct mutex lock;
+
+	/* Engine configuration, protected by lock */
+	u64 period_ns;		/* Common period of all enabled channels */
+	u64 duty_ns[NUM_PINS];
+	u16 enabled;		/* Engine channels, also written under i2c_lock */
+	u16 inversed;		/* Channels with inversed polarity */
+	bool changed;
+
+	/* Statistics */
+	ktime_t start;
+	u64 writes;
+	u64 periods;
+	u64 overruns;
+};
+
+struct kts1622_keypad {
+	struct input_dev *input;
+	struct delayed_work work;
+	bool enabled;
+
+	unsigned int rows;
+	unsigned int cols;
+	unsigned int row_shift;
+	u8 row_port;		/* Port reading the rows, the other drives columns */
+	u8 row_mask;
+	u8 col_mask;
+	u32 debounce_ms;
+	u32 col_delay_us;
+
+	u8 state[NUM_PINS_PER_PORT];	/* Pressed rows, per column */
+};
+
+struct kts1622_encoder {
+	u8 pin_a;
+	u8 pin_b;
+	u8 state;		/* Last decoded AB */
+	int accum;		/* Quadrature steps not yet reported */
+	s64 count;		/* Detents since probe */
+	u32 errors;		/* Undecodable transitions (missed edges) */
+};
+
+struct kts1622_encoders {
+	struct input_dev *input;
+	int num;
+	u32 steps;		/* Quadrature steps per reported detent */
+	struct kts1622_encoder enc[NUM_PINS / 2];
+	u8 pins[NUM_PORTS];	/* Lines owned by the decoder */
+	u8 edge[4];		/* Edge bits forced for those lines */
+};
+
+struct kts1622_pm {
+	bool runtime;		/* Runtime PM enabled from DT */
+	u64 resume_us;		/* Last register restore */
+	u64 resume_max_us;
+	u32 resume_count;
+};
+
+struct kts1622_err {
+	u32 retries;
+	u32 budget_us;
+	u32 recover_after;
+	atomic_t failed;	/* Transfers failed in a row */
+	struct work_struct recover_work;
+	spinlock_t lock;	/* dying */
+	bool dying;		/* No recovery is queued any more */
+
+	/* Statistics */
+	atomic_t errors;	/* Transfers that failed after all retries */
+	atomic_t retried;
+	atomic_t budget_exceeded;
+	atomic_t recoveries;
+	atomic_t resyncs;
+};
+
+/* Per-line interrupt rate limit, applied before dispatch */
+struct kts1622_irq_rl {
+	u32 burst;		/* Events per line and interval, 0 for no limit */
+	u32 interval_ms;
+	bool mask;		/* Mask throttled lines in hardware */
+
+	spinlock_t lock;	/* State below */
+	u64 window[NUM_PINS];	/* Start of the line's interval, ns */
+	u32 count[NUM_PINS];	/* Events dispatched in it */
+	u8 throttled[NUM_PORTS];	/* Lines that dropped events */
+	u8 masked[NUM_PORTS];	/* Throttled lines masked in hardware */
+	u64 dropped[NUM_PINS];
+	bool pending;		/* Release due at release_at */
+	unsigned long release_at;	/* jiffies */
+	bool dying;		/* The timer is not armed any more */
+	struct timer_list release_timer;	/* Wakes the interrupt servicing */
+};
+
+/*
+ * Reflex rule: when (inputs & in_mask) == in_match the outputs in out_mask
+ * take out_val, otherwise out_else. Bit n is line n, levels are physical.
+ */
+struct kts1622_reflex_rule {
+	u16 in_mask;
+	u16 in_match;
+	u16 out_mask;
+	u16 out_val;
+	u16 out_else;
+
+	/* Statistics */
+	u64 evals;
+	u64 reactions;		/* Evaluations that changed an output */
+	u64 last_ns;		/* Interrupt to output written */
+	u64 max_ns;
+	u64 total_ns;
+};
+
+/* Rules evaluated in the interrupt handler, protected by i2c_lock */
+struct kts1622_reflex {
+	struct kts1622_reflex_rule rule[KTS1622_REFLEX_MAX];
+	u8 active;		/* BIT(rule) */
+	u8 pins[NUM_PORTS];	/* Rule inputs, kept armed */
+	u8 edge[4];		/* Both edges for those */
+};
+
+struct kts1622_pattern_waiter {
+	struct list_head node;	/* In waiters until matched */
+	u16 mask;
+	u16 value;
+	u16 input;		/* Snapshot that matched */
+	u64 ts;
+	int err;
+	struct completion done;
+};
+
+/*
+ * Character device of the wait-for-pattern ioctl. It can stay open after the
+ * chip is unbound, so it is reference counted and chip is cleared on remove.
+ */
+struct kts1622_pattern {
+	struct kref ref;
+	struct miscdevice misc;
+	bool registered;
+	struct rw_semaphore rwsem;	/* Held for reading while using chip */
+	struct kts1622_chip *chip;
+
+	spinlock_t lock;		/* waiters, dead */
+	struct list_head waiters;
+	bool dead;
+	unsigned int users[NUM_PINS];	/* Waiters per line, under irq_lock */
+};
+
+enum kts1622_sched {
+	KTS1622_SCHED_NORMAL,
+	KTS1622_SCHED_FIFO_LOW,
+	KTS1622_SCHED_FIFO,
+};
+
+static const char * const kts1622_sched_names[] = {
+	[KTS1622_SCHED_NORMAL]		= "normal",
+	[KTS1622_SCHED_FIFO_LOW]	= "fifo-low",
+	[KTS1622_SCHED_FIFO]		= "fifo",
+};
+
+/* Dedicated thread for interrupt servicing, NULL worker if not configured */
+struct kts1622_worker {
+	struct kthread_worker *worker;
+	struct kthread_work irq_work;	/* Queued by the hard handler */
+	struct kthread_work poll_work;	/* Status check without an interrupt */
+	irq_handler_t irq_fn;		/* Set when the interrupt runs here */
+	u64 kick_ns;			/* Hard interrupt, 0 once serviced */
+
+	struct mutex lock;		/* Settings below */
+	enum kts1622_sched sched;
+	struct cpumask cpus;
+};
+
+struct kts1622_irq_group {
+	struct list_head node;		/* In kts1622_irq_groups */
+	struct list_head chips;
+	struct mutex lock;
+	int irq;
+};
+
+/* Worker per root adapter, for multi-chip operations spanning several buses */
+struct kts1622_bus {
+	struct list_head node;		/* In kts1622_buses */
+	struct i2c_adapter *adapter;
+	struct kthread_worker *worker;
+	int users;
+	bool fifo;			/* Worker runs SCHED_FIFO */
+};
+
+/* Completion tracking of the parts of a multi-chip operation */
+struct kts1622_bus_sync {
+	atomic_t pending;
+	struct completion done;
+};
+
+/* Part of a multi-chip operation, all of it on one bus */
+struct kts1622_bus_op {
+	struct kthread_work work;
+	struct kts1622_bus_sync *sync;
+	struct kts1622_bus *bus;
+	void (*fn)(struct kts1622_bus_op *op);
+	void *data;
+	int irq;
+	int result;
+};
+
+struct kts1622_chip;
+
+struct kts1622_aggregate {
+	struct gpio_chip gc;
+	struct kts1622_chip *chips[KTS1622_AGGREGATE_MAX];
+	int num;
+	unsigned int nports;	/* Members are all the same variant */
+	unsigned int chip_ngpio;
+	bool raw_i2c;		/* Adapter takes multi-message transfers */
+	u8 lock_order[KTS1622_AGGREGATE_MAX];	/* Member indices in lock order */
+	/* Member lines held while the aggregate line is requested */
+	struct gpio_desc *descs[KTS1622_AGGREGATE_MAX * NUM_PINS];
+};
+
+struct kts1622_xfer {
+	u8 single;		/* Path per access size */
+	u8 pair;
+	u8 bulk;
+	bool raw;		/* Multi-message transfers available */
+	u32 supported;		/* BIT(path) */
+	u64 single_ns[KTS1622_XFER_NUM];	/* Probe benchmark, 0 if not run */
+	u64 pair_ns[KTS1622_XFER_NUM];
+};
+
 struct kts1622_chip {
 	struct i2c_client *client;
 	struct gpio_chip gpio_chip;
 
 	struct mutex i2c_lock;
-	unsigned driver_data; /* Reserved */
+	struct lock_class_key i2c_lock_key;	/* Per chip, see kts1622_aggregate_lock() */
+	const struct kts1622_chip_info *info;
+	unsigned int nports;	/* info->nports, used on every hot path */
+	struct kts1622_xfer xfer;
+	u8 reg_cache[KTS1622_NUM_REGS];	/* Shadow of the writable registers */
+	u8 latch_pending[NUM_PORTS];	/* Latched lines not yet read back */
+	u8 latch_val[NUM_PORTS];	/* Their values from the interrupt */
+
+	struct gpio_desc *reset_gpio;
+	bool no_general_call_reset;
+	bool warm_attach;
+
+	struct kts1622_pwm pwm;
+	struct kts1622_keypad keypad;
+	struct kts1622_encoders encoders;
+	struct kts1622_pm pm;
+	struct kts1622_err err;
+	struct kts1622_worker worker;
+	struct kts1622_irq_rl irq_rl;
+	struct kts1622_reflex reflex;
+	struct kts1622_pattern *pattern;
+	u8 watch_pins[NUM_PORTS];	/* Lines armed for pattern waiters */
+	u8 watch_edge[4];
+	struct dentry *debugfs;
+	struct kts1622_aggregate aggregate;
+	bool probed;
 
 	struct mutex irq_lock;
 	struct irq_chip irq_chip;
-	u8 irq_mask[2];
-	u8 irq_edge[4];
+	u8 irq_mask[NUM_PORTS];
+	u8 irq_edge[NUM_PORTS * 2];
 	int irq_base;
+	bool irq_gated;		/* Parent interrupt disabled for PM */
+	bool irq_shared;	/* Parent interrupt wired to other devices */
+	struct kts1622_irq_group *irq_group;
+	struct kts1622_bus *bus;	/* Set while in an interrupt group */
+	struct task_struct *irq_task;	/* Interrupt thread, for the recorder */
+	struct list_head irq_group_node;
+	bool irq_group_done;	/* Serviced in the current group pass */
 };
 
-static int kts1622_software_reset(struct kts1622_chip *chip)
+/* Registers that change behind our back or are write-only strobes */
+static bool kts1622_reg_is_volatile(u8 reg_addr)
 {
-	struct i2c_client *i2c = chip->client;
-	int ret;
-	u8 orig_addr = i2c->addr;
+	switch (reg_addr) {
+	case KTS1622_INPUT_0:
+	case KTS1622_INPUT_1:
+	case KTS1622_INTERRUPT_STATUS_0:
+	case KTS1622_INTERRUPT_STATUS_1:
+	case KTS1622_INTERRUPT_CLEAR_0:
+	case KTS1622_INTERRUPT_CLEAR_1:
+	case KTS1622_INPUT_STATUS_0:
+	case KTS1622_INPUT_STATUS_1:
+		return true;
+	default:
+		return reg_addr >= KTS1622_NUM_REGS;
+	}
+}
 
-	i2c->addr = 0x00;
-	/* Software reset command (0x06) */
-	ret = i2c_smbus_write_byte(i2c, 0x06);
-	i2c->addr = orig_addr;
+static void kts1622_cache_update(struct kts1622_chip *chip, u8 reg_addr,
+				 u8 len, const u8 *buf)
+{
+	int i;
 
-	return ret;
+	for (i = 0; i < len; i++)
+		if (!kts1622_reg_is_volatile(reg_addr + i))
+			chip->reg_cache[reg_addr + i] = buf[i];
 }
 
-static int kts1622_reg_write(struct kts1622_chip *chip, u8 reg_addr, u8 reg_val)
+/*
+ * Bus transaction recorder. When enabled through debugfs, every transfer of
+ * every chip goes into one ring, so traffic of two driver versions under the
+ * same workload can be compared (see src/lib/kts1622_replay.cpp).
+ */
+#define KTS1622_TRACE_ENTRIES		(4096)
+#define KTS1622_TRACE_DATA			(12)	/* Longest register run */
+
+#define KTS1622_TRACE_READ			BIT(0)
+#define KTS1622_TRACE_CONT			BIT(1)	/* Same transfer as the previous entry */
+
+enum kts1622_trace_class {
+	KTS1622_TRACE_TASK,
+	KTS1622_TRACE_IRQ,
+	KTS1622_TRACE_PWM,
+	KTS1622_TRACE_KEYPAD,
+};
+
+static const char * const kts1622_trace_class_names[] = {
+	[KTS1622_TRACE_TASK]	= "task",
+	[KTS1622_TRACE_IRQ]	= "irq",
+	[KTS1622_TRACE_PWM]	= "pwm",
+	[KTS1622_TRACE_KEYPAD]	= "keypad",
+};
+
+struct kts1622_trace_entry {
+	u64 ts;			/* ktime_get_ns() at the start of the transfer */
+	u32 duration;		/* ns, on the first entry of a transfer */
+	s16 ret;
+	u8 addr;
+	u8 flags;
+	u8 class;
+	u8 path;
+	u8 reg;
+	u8 len;
+	u8 data[KTS1622_TRACE_DATA];
+};
+
+static struct {
+	spinlock_t lock;
+	bool enabled;
+	struct kts1622_trace_entry *ring;	/* Allocated on the first enable */
+	unsigned int head;
+	unsigned int count;
+	u64 dropped;		/* Overwritten before being read */
+} kts1622_trace = {
+	.lock = __SPIN_LOCK_UNLOCKED(kts1622_trace.lock),
+};
+
+/* Start timestamp of a transfer, 0 when not recording */
+static inline u64 kts1622_trace_start(void)
 {
-	struct i2c_client *i2c = chip->client;
-	int ret;
+	return READ_ONCE(kts1622_trace.enabled) ? ktime_get_ns() : 0;
+}
 
-	ret = i2c_smbus_write_byte_data(i2c, reg_addr, reg_val);
+static u8 kts1622_trace_class(struct kts1622_chip *chip)
+{
+	if (current == READ_ONCE(chip->irq_task))
+		return KTS1622_TRACE_IRQ;
+	if (current == chip->pwm.thread)
+		return KTS1622_TRACE_PWM;
+	if (current_work() == &chip->keypad.work.work)
+		return KTS1622_TRACE_KEYPAD;
+
+	return KTS1622_TRACE_TASK;
+}
 
-	return ret;
+static void kts1622_trace_record(struct kts1622_chip *chip, u64 start, u8 flags,
+				 u8 path, u8 reg_addr, u8 len, const u8 *data,
+				 int ret)
+{
+	struct kts1622_trace_entry *e;
+	unsigned long irqflags;
+	u64 now;
+
+	if (!start)
+		return;
+	now = ktime_get_ns();
+
+	spin_lock_irqsave(&kts1622_trace.lock, irqflags);
+	if (kts1622_trace.ring) {
+		e = &kts1622_trace.ring[kts1622_trace.head];
+		e->ts = start;
+		e->duration = flags & KTS1622_TRACE_CONT ? 0 :
+			      min_t(u64, now - start, U32_MAX);
+		e->ret = clamp(ret, S16_MIN, S16_MAX);
+		e->addr = chip->client->addr;
+		e->flags = flags;
+		e->class = kts1622_trace_class(chip);
+		e->path = path;
+		e->reg = reg_addr;
+		e->len = len;
+		memset(e->data, 0, sizeof(e->data));
+		if (ret >= 0)
+			memcpy(e->data, data, min_t(u8, len, KTS1622_TRACE_DATA));
+
+		kts1622_trace.head = (kts1622_trace.head + 1) % KTS1622_TRACE_ENTRIES;
+		if (kts1622_trace.count < KTS1622_TRACE_ENTRIES)
+			kts1622_trace.count++;
+		else
+			kts1622_trace.dropped++;
+	}
+	spin_unlock_irqrestore(&kts1622_trace.lock, irqflags);
 }
 
-static int kts1622_reg_read(struct kts1622_chip *chip, u8 reg_addr, u8 *reg_val)
+/*
+ * Transfer paths. The cheapest primitive the adapter offers is picked at
+ * probe for single registers, port pairs and longer runs.
+ */
+static const char * const kts1622_xfer_names[] = {
+	[KTS1622_XFER_BYTE]		= "smbus-byte",
+	[KTS1622_XFER_SMBUS_WORD]	= "smbus-word",
+	[KTS1622_XFER_SMBUS_BLOCK]	= "smbus-i2c-block",
+	[KTS1622_XFER_RAW]		= "i2c",
+};
+
+static int __kts1622_xfer_read(struct kts1622_chip *chip, u8 path, u8 reg_addr,
+			       u8 len, u8 *buf)
 {
 	struct i2c_client *i2c = chip->client;
+	struct i2c_msg msgs[] = {
+		{ .addr = i2c->addr, .len = 1, .buf = &reg_addr },
+		{ .addr = i2c->addr, .flags = I2C_M_RD, .len = len, .buf = buf },
+	};
 	int ret;
+	int i;
 
-	ret = i2c_smbus_read_byte_data(i2c, reg_addr);
+	switch (path) {
+	case KTS1622_XFER_RAW:
+		ret = i2c_transfer(i2c->adapter, msgs, ARRAY_SIZE(msgs));
+		if (ret < 0)
+			return ret;
+		return ret == ARRAY_SIZE(msgs) ? 0 : -EIO;
 
-	if (ret < 0)
-		return ret;
+	case KTS1622_XFER_SMBUS_BLOCK:
+		ret = i2c_smbus_read_i2c_block_data(i2c, reg_addr, len, buf);
+		if (ret < 0)
+			return ret;
+		return ret == len ? 0 : -EIO;
+
+	case KTS1622_XFER_SMBUS_WORD:
+		if (len != 2)
+			break;
+		ret = i2c_smbus_read_word_data(i2c, reg_addr);
+		if (ret < 0)
+			return ret;
+		buf[0] = ret & 0xFF;
+		buf[1] = ret >> 8;
+		return 0;
+	}
+
+	for (i = 0; i < len; i++) {
+		ret = i2c_smbus_read_byte_data(i2c, reg_addr + i);
+		if (ret < 0)
+			return ret;
+		buf[i] = ret;
+	}
 
-	*reg_val = ret;
 	return 0;
 }
 
-static int kts1622_reg_bit_set(struct kts1622_chip *chip, u8 reg_addr, u8 bit, u8 bit_val)
+static int __kts1622_xfer_write(struct kts1622_chip *chip, u8 path, u8 reg_addr,
+				u8 len, const u8 *buf)
 {
-	u8 reg_val;
+	struct i2c_client *i2c = chip->client;
+	u8 msg_buf[1 + I2C_SMBUS_BLOCK_MAX];
+	struct i2c_msg msg = {
+		.addr = i2c->addr, .len = 1 + len, .buf = msg_buf,
+	};
 	int ret;
+	int i;
+
+	switch (path) {
+	case KTS1622_XFER_RAW:
+		if (len > I2C_SMBUS_BLOCK_MAX)
+			return -EINVAL;
+		msg_buf[0] = reg_addr;
+		memcpy(&msg_buf[1], buf, len);
+		ret = i2c_transfer(i2c->adapter, &msg, 1);
+		if (ret < 0)
+			return ret;
+		return ret == 1 ? 0 : -EIO;
 
-	ret = kts1622_reg_read(chip, reg_addr, &reg_val);
-	if (ret < 0)
-		return ret;
+	case KTS1622_XFER_SMBUS_BLOCK:
+		return i2c_smbus_write_i2c_block_data(i2c, reg_addr, len, buf);
 
-	if (bit_val)
-		reg_val |= 1 << bit;
-	else
-		reg_val &= ~(1 << bit);
+	case KTS1622_XFER_SMBUS_WORD:
+		if (len != 2)
+			break;
+		return i2c_smbus_write_word_data(i2c, reg_addr, buf[0] | (buf[1] << 8));
+	}
 
-	ret = kts1622_reg_write(chip, reg_addr, reg_val);
-	if (ret < 0)
-		return ret;
+	for (i = 0; i < len; i++) {
+		ret = i2c_smbus_write_byte_data(i2c, reg_addr + i, buf[i]);
+		if (ret < 0)
+			return ret;
+	}
 
 	return 0;
 }
 
-static int kts1622_gpio_get_value(struct gpio_chip *gc, unsigned offset)
+/*
+ * Bus errors: NAKs, lost arbitration and timeouts are retried while the
+ * transfer is within its latency budget. A run of failed transfers kicks
+ * adapter bus recovery and a rewrite of the shadow, from a work item so the
+ * failing caller is not held up any further.
+ */
+static bool kts1622_xfer_retry(struct kts1622_chip *chip, int ret, int attempt,
+			       u64 first)
 {
-	struct kts1622_chip *chip = gpiochip_get_data(gc);
-	int port = offset / 8;
-	int pin = offset % 8;
-	u8 reg_val;
-	int ret;
+	switch (ret) {
+	case -EAGAIN:		/* Arbitration lost */
+	case -ENXIO:		/* NAK */
+	case -EREMOTEIO:
+	case -ETIMEDOUT:
+	case -EIO:
+		break;
+	default:
+		return false;
+	}
 
-	mutex_lock(&chip->i2c_lock);
-	ret = kts1622_reg_read(chip, KTS1622_INPUT_0 + port, &reg_val);
-	mutex_unlock(&chip->i2c_lock);
-	if (ret < 0)
-		return ret;
+	if (attempt >= chip->err.retries)
+		return false;
 
-	return !!(reg_val & (1 << pin));
+	if (ktime_get_ns() - first >= (u64)chip->err.budget_us * NSEC_PER_USEC) {
+		atomic_inc(&chip->err.budget_exceeded);
+		return false;
+	}
+
+	atomic_inc(&chip->err.retried);
+	return true;
 }
 
-static void kts1622_gpio_set_value(struct gpio_chip *gc, unsigned offset, int val)
+static void kts1622_recover_schedule(struct kts1622_chip *chip)
 {
-	struct kts1622_chip *chip = gpiochip_get_data(gc);
-	int port = offset / 8;
-	int pin = offset % 8;
-	u8 reg_addr = KTS1622_OUTPUT_0 + port;
+	spin_lock(&chip->err.lock);
+	if (!chip->err.dying)
+		schedule_work(&chip->err.recover_work);
+	spin_unlock(&chip->err.lock);
+}
 
-	mutex_lock(&chip->i2c_lock);
-	kts1622_reg_bit_set(chip, reg_addr, pin, val ? 1 : 0);
-	mutex_unlock(&chip->i2c_lock);
+static int kts1622_xfer_done(struct kts1622_chip *chip, int ret)
+{
+	if (ret >= 0) {
+		atomic_set(&chip->err.failed, 0);
+		return ret;
+	}
+
+	atomic_inc(&chip->err.errors);
+	if (atomic_inc_return(&chip->err.failed) == chip->err.recover_after)
+		kts1622_recover_schedule(chip);
+
+	return ret;
 }
 
-static int kts1622_gpio_set_direction(struct gpio_chip *gc, unsigned offset, int direction)
+static int kts1622_xfer_read(struct kts1622_chip *chip, u8 path, u8 reg_addr,
+			     u8 len, u8 *buf)
 {
-	struct kts1622_chip *chip = gpiochip_get_data(gc);
-	int port = offset / 8;
-	int pin = offset % 8;
-	u8 reg_addr = KTS1622_CONFIG_0 + port;
+	u64 first = ktime_get_ns();
+	int attempt = 0;
 	int ret;
 
-	mutex_lock(&chip->i2c_lock);
+	do {
+		u64 start = kts1622_trace_start();
 
-	if (direction == PIN_OUTPUT)
-		ret = kts1622_reg_bit_set(chip, reg_addr, pin, 0);
-	else
-		ret = kts1622_reg_bit_set(chip, reg_addr, pin, 1);
+		ret = __kts1622_xfer_read(chip, path, reg_addr, len, buf);
+		kts1622_trace_record(chip, start, KTS1622_TRACE_READ, path,
+				     reg_addr, len, buf, ret);
+	} while (ret < 0 && kts1622_xfer_retry(chip, ret, attempt++, first));
 
-	mutex_unlock(&chip->i2c_lock);
+	return kts1622_xfer_done(chip, ret);
+}
 
-	return ret;
+static int kts1622_xfer_write(struct kts1622_chip *chip, u8 path, u8 reg_addr,
+			      u8 len, const u8 *buf)
+{
+	u64 first = ktime_get_ns();
+	int attempt = 0;
+	int ret;
+
+	do {
+		u64 start = kts1622_trace_start();
+
+		ret = __kts1622_xfer_write(chip, path, reg_addr, len, buf);
+		kts1622_trace_record(chip, start, 0, path, reg_addr, len, buf, ret);
+	} while (ret < 0 && kts1622_xfer_retry(chip, ret, attempt++, first));
+
+	return kts1622_xfer_done(chip, ret);
 }
 
-static int kts1622_gpio_direction_input(struct gpio_chip *gc, unsigned offset)
+static void kts1622_trace_msgs(struct kts1622_chip **owners,
+			       const struct i2c_msg *msgs, int num, u64 start,
+			       int ret)
 {
-	return kts1622_gpio_set_direction(gc, offset, PIN_INPUT);
+	u8 cont = 0;
+	int i;
+
+	for (i = 0; i < num; i++) {
+		const struct i2c_msg *msg = &msgs[i];
+
+		/* A register pointer write is traced with the read it sets up */
+		if (msg->flags & I2C_M_RD)
+			kts1622_trace_record(owners[i], start,
+					     KTS1622_TRACE_READ | cont,
+					     KTS1622_XFER_RAW,
+					     i ? msgs[i - 1].buf[0] : 0,
+					     msg->len, msg->buf, ret);
+		else if (msg->len > 1)
+			kts1622_trace_record(owners[i], start, cont,
+					     KTS1622_XFER_RAW, msg->buf[0],
+					     msg->len - 1, &msg->buf[1], ret);
+		else
+			continue;
+		cont = KTS1622_TRACE_CONT;
+	}
 }
 
-static int kts1622_gpio_direction_output(struct gpio_chip *gc, unsigned offset, int val)
+/*
+ * Combined plain I2C transfer, for accesses the register paths cannot express,
+ * possibly to several chips on one adapter. owners[i] is the chip msgs[i]
+ * addresses, messages of one chip are adjacent. The retry budget is the first
+ * chip's; a failure counts against every chip taking part.
+ */
+static int kts1622_xfer_msgs(struct kts1622_chip **owners, struct i2c_msg *msgs,
+			     int num)
 {
-	/* Set output value. */
-	kts1622_gpio_set_value(gc, offset, val);
+	struct kts1622_chip *chip = owners[0];
+	u64 first = ktime_get_ns();
+	int attempt = 0;
+	int ret;
+	int i;
 
-	/* Then, set output mode. */
-	return kts1622_gpio_set_direction(gc, offset, PIN_OUTPUT);
+	do {
+		u64 start = kts1622_trace_start();
+
+		ret = i2c_transfer(chip->client->adapter, msgs, num);
+		if (ret >= 0)
+			ret = ret == num ? 0 : -EIO;
+		kts1622_trace_msgs(owners, msgs, num, start, ret);
+	} while (ret < 0 && kts1622_xfer_retry(chip, ret, attempt++, first));
+
+	for (i = 0; i < num; i++)
+		if (!i || owners[i] != owners[i - 1])
+			kts1622_xfer_done(owners[i], ret);
+
+	return ret;
 }
 
-static int kts1622_gpio_get_direction(struct gpio_chip *gc, unsigned offset)
+static inline u8 kts1622_xfer_path(struct kts1622_chip *chip, u8 len)
 {
-	struct kts1622_chip *chip = gpiochip_get_data(gc);
-	int port = offset / 8;
-	int pin = offset % 8;
-	u8 reg_addr = KTS1622_CONFIG_0 + port;
-	u8 reg_val;
-	int ret;
+	if (len == 1)
+		return chip->xfer.single;
+	if (len == 2)
+		return chip->xfer.pair;
+	return chip->xfer.bulk;
+}
 
-	mutex_lock(&chip->i2c_lock);
-	ret = kts1622_reg_read(chip, reg_addr, &reg_val);
-	mutex_unlock(&chip->i2c_lock);
+static u64 kts1622_xfer_bench(struct kts1622_chip *chip, u8 path, u8 len)
+{
+	ktime_t start = ktime_get();
+	u8 buf[2];
+	int i;
 
-	if (ret < 0)
-		return ret;
+	for (i = 0; i < KTS1622_XFER_BENCH_LOOPS; i++)
+		if (kts1622_xfer_read(chip, path, KTS1622_INPUT_0, len, buf) < 0)
+			return 0;
 
-	return !!(reg_val & (1 << pin));
+	return div_u64(ktime_to_ns(ktime_sub(ktime_get(), start)),
+		       KTS1622_XFER_BENCH_LOOPS);
 }
 
-static int kts1622_gpio_set_pull_up_down(struct kts1622_chip *chip,
-					 unsigned int offset,
-					 unsigned long config)
+static u8 kts1622_xfer_fastest(const u64 *ns, u32 candidates, u8 fallback)
 {
-	int port = offset / 8;
-	int pin = offset % 8;
-	u8 reg_en_addr = KTS1622_PULLUP_DOWN_ENABLE_0 + port;
-	u8 reg_sel_addr = KTS1622_PULLUP_DOWN_SELECTION_0 + port;
-	int ret;
+	unsigned long bits = candidates;
+	u8 best = fallback;
+	int path;
 
-	mutex_lock(&chip->i2c_lock);
+	for_each_set_bit(path, &bits, KTS1622_XFER_NUM)
+		if (ns[path] && (!ns[best] || ns[path] < ns[best]))
+			best = path;
 
-	/* Disable pull-up/pull-down */
-	ret = kts1622_reg_bit_set(chip, reg_en_addr, pin, PULL_UP_DOWN_DISABLE);
-	if (ret < 0)
-		goto exit;
+	return best;
+}
 
-	/* Configure pull-up/pull-down */
-	if (config == PIN_CONFIG_BIAS_PULL_UP) {
-		ret = kts1622_reg_bit_set(chip, reg_sel_addr, pin, PULL_UP);
-		if (ret < 0)
-			goto exit;
-		ret = kts1622_reg_bit_set(chip, reg_en_addr, pin, PULL_UP_DOWN_ENABLE);
+/*
+ * Pick the transfer path per access size from the adapter functionality.
+ * Single registers prefer native SMBus byte accesses, everything longer the
+ * most capable primitive. When the adapter offers more than one path the probe
+ * times a few INPUT reads on every candidate and keeps the fastest instead,
+ * which matters on bit-banged adapters where emulation costs differ.
+ * kinetic_technologies,no-xfer-benchmark keeps the static choice.
+ */
+static int kts1622_xfer_setup(struct kts1622_chip *chip)
+{
+	struct i2c_adapter *adapter = chip->client->adapter;
+	struct device *dev = &chip->client->dev;
+	struct kts1622_xfer *xfer = &chip->xfer;
+	u32 single_candidates;
+	int path;
+
+	if (i2c_check_functionality(adapter, I2C_FUNC_SMBUS_BYTE_DATA))
+		xfer->supported |= BIT(KTS1622_XFER_BYTE);
+	if (i2c_check_functionality(adapter, I2C_FUNC_SMBUS_WORD_DATA))
+		xfer->supported |= BIT(KTS1622_XFER_SMBUS_WORD);
+	if (i2c_check_functionality(adapter, I2C_FUNC_SMBUS_I2C_BLOCK))
+		xfer->supported |= BIT(KTS1622_XFER_SMBUS_BLOCK);
+	if (i2c_check_functionality(adapter, I2C_FUNC_I2C))
+		xfer->supported |= BIT(KTS1622_XFER_RAW);
+
+	single_candidates = xfer->supported &
+			    (BIT(KTS1622_XFER_BYTE) | BIT(KTS1622_XFER_RAW));
+	if (!single_candidates) {
+		dev_err(dev, "adapter supports neither I2C nor SMBus byte data\n");
+		return -ENODEV;
+	}
 
-	} else if (config == PIN_CONFIG_BIAS_PULL_DOWN) {
-		ret = kts1622_reg_bit_set(chip, reg_sel_addr, pin, PULL_DOWN);
-		if (ret < 0)
-			goto exit;
-		ret = kts1622_reg_bit_set(chip, reg_en_addr, pin, PULL_UP_DOWN_ENABLE);
+	xfer->raw = !!(xfer->supported & BIT(KTS1622_XFER_RAW));
+	xfer->single = __ffs(single_candidates);
+	xfer->pair = fls(xfer->supported) - 1;
+	xfer->bulk = fls(xfer->supported & ~BIT(KTS1622_XFER_SMBUS_WORD)) - 1;
 
-	} else if (config == PIN_CONFIG_BIAS_DISABLE) {
-		ret = kts1622_reg_bit_set(chip, reg_en_addr, pin, PULL_UP_DOWN_DISABLE);
+	if (hweight32(xfer->supported) < 2 ||
+	    device_property_read_bool(dev, "kinetic_technologies,no-xfer-benchmark"))
+		return 0;
+
+	for (path = 0; path < KTS1622_XFER_NUM; path++) {
+		if (!(xfer->supported & BIT(path)))
+			continue;
+		if (single_candidates & BIT(path))
+			xfer->single_ns[path] = kts1622_xfer_bench(chip, path, 1);
+		xfer->pair_ns[path] = kts1622_xfer_bench(chip, path, 2);
 	}
 
-	if (ret)
-		goto exit;
-exit:
-	mutex_unlock(&chip->i2c_lock);
-	return ret;
+	xfer->single = kts1622_xfer_fastest(xfer->single_ns, single_candidates,
+					    xfer->single);
+	xfer->pair = kts1622_xfer_fastest(xfer->pair_ns, xfer->supported,
+					  xfer->pair);
+
+	return 0;
 }
 
-static int kts1622_gpio_set_open_drain(struct kts1622_chip *chip,
-					 unsigned int offset,
-					 unsigned long config)
+static int kts1622_reg_write(struct kts1622_chip *chip, u8 reg_addr, u8 reg_val)
 {
-	int port = offset / 8;
-	int pin = offset % 8;
-	u8 reg_addr = KTS1622_INDIVIDUAL_PIN_OUTPUT_0 + port;
 	int ret;
 
-	mutex_lock(&chip->i2c_lock);
+	ret = kts1622_xfer_write(chip, chip->xfer.single, reg_addr, 1, &reg_val);
+	if (ret == 0)
+		kts1622_cache_update(chip, reg_addr, 1, &reg_val);
 
-	/* Configure Open-drain/Push-pull */
-	if (config == PIN_CONFIG_DRIVE_OPEN_DRAIN)
+	return ret;
+}
+
+static int kts1622_reg_read(struct kts1622_chip *chip, u8 reg_addr, u8 *reg_val)
+{
+	int ret;
+
+	ret = kts1622_xfer_read(chip, chip->xfer.single, reg_addr, 1, reg_val);
+	if (ret < 0)
+		return ret;
+
+	kts1622_cache_update(chip, reg_addr, 1, reg_val);
+	return 0;
+}
+
+/* The register pointer auto-increments, so port pairs go in one transfer. */
+static int kts1622_reg_write_block(struct kts1622_chip *chip, u8 reg_addr,
+				   u8 len, const u8 *buf)
+{
+	int ret;
+
+	ret = kts1622_xfer_write(chip, kts1622_xfer_path(chip, len), reg_addr,
+				 len, buf);
+	if (ret == 0)
+		kts1622_cache_update(chip, reg_addr, len, buf);
+
+	return ret;
+}
+
+static int kts1622_reg_read_block(struct kts1622_chip *chip, u8 reg_addr,
+				  u8 len, u8 *buf)
+{
+	int ret;
+
+	ret = kts1622_xfer_read(chip, kts1622_xfer_path(chip, len), reg_addr,
+				len, buf);
+	if (ret < 0)
+		return ret;
+
+	kts1622_cache_update(chip, reg_addr, len, buf);
+	return 0;
+}
+
+/* Read-modify-write against the shadow, only the write reaches the bus. */
+static int kts1622_reg_bit_set(struct kts1622_chip *chip, u8 reg_addr, u8 bit, u8 bit_val)
+{
+	u8 reg_val = chip->reg_cache[reg_addr];
+
+	if (bit_val)
+		reg_val |= 1 << bit;
+	else
+		reg_val &= ~(1 << bit);
+
+	if (reg_val == chip->reg_cache[reg_addr])
+		return 0;
+
+	return kts1622_reg_write(chip, reg_addr, reg_val);
+}
+
+/* Same as kts1622_reg_bit_set() for every bit in @mask. */
+static int kts1622_reg_update_bits(struct kts1622_chip *chip, u8 reg_addr,
+				   u8 mask, u8 val)
+{
+	u8 reg_val = (chip->reg_cache[reg_addr] & ~mask) | (val & mask);
+
+	if (reg_val == chip->reg_cache[reg_addr])
+		return 0;
+
+	return kts1622_reg_write(chip, reg_addr, reg_val);
+}
+
+/* Write the whole shadow back to the chip, one block per register run. */
+static int kts1622_cache_sync(struct kts1622_chip *chip)
+{
+	int ret;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kts1622_reg_ranges); i++) {
+		u8 first = kts1622_reg_ranges[i].first;
+		u8 len = kts1622_reg_ranges[i].last - first + 1;
+
+		ret = kts1622_reg_write_block(chip, first, len,
+					      &chip->reg_cache[first]);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Bring the chip to the register image regs[] (indexed by register address).
+ * Only the span of changed registers in each run is written, as one block.
+ */
+static int kts1622_cache_apply(struct kts1622_chip *chip, const u8 *regs)
+{
+	int ret;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kts1622_reg_ranges); i++) {
+		int first = kts1622_reg_ranges[i].first;
+		int last = kts1622_reg_ranges[i].last;
+
+		while (first <= last && regs[first] == chip->reg_cache[first])
+			first++;
+		while (last >= first && regs[last] == chip->reg_cache[last])
+			last--;
+		if (first > last)
+			continue;
+
+		ret = kts1622_reg_write_block(chip, first, last - first + 1,
+					      &regs[first]);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * The general-call software reset resets every device on the bus that
+ * listens to address 0x00, so it is the last resort after the reset line.
+ * Without either, the registers are reinitialized to their power-on values.
+ */
+static int kts1622_software_reset(struct kts1622_chip *chip)
+{
+	struct i2c_client *i2c = chip->client;
+	int ret;
+	u8 orig_addr = i2c->addr;
+
+	i2c->addr = 0x00;
+	/* Software reset command (0x06) */
+	ret = i2c_smbus_write_byte(i2c, KTS1622_GENERAL_CALL_RESET);
+	i2c->addr = orig_addr;
+
+	return ret;
+}
+
+static int kts1622_reset(struct kts1622_chip *chip)
+{
+	int ret = 0;
+
+	memcpy(chip->reg_cache, kts1622_reg_defaults, KTS1622_NUM_REGS);
+
+	if (chip->reset_gpio) {
+		gpiod_set_value_cansleep(chip->reset_gpio, 1);
+		usleep_range(KTS1622_RESET_PULSE_US, KTS1622_RESET_PULSE_US * 2);
+		gpiod_set_value_cansleep(chip->reset_gpio, 0);
+		usleep_range(KTS1622_RESET_RECOVERY_US, KTS1622_RESET_RECOVERY_US * 2);
+	} else if (!chip->no_general_call_reset) {
+		ret = kts1622_software_reset(chip);
+	} else {
+		ret = kts1622_cache_sync(chip);
+	}
+
+	return ret;
+}
+
+/*
+ * For writes whose caller cannot report an error: on failure the shadow
+ * still takes the value, and the resync after bus recovery writes it.
+ */
+static int kts1622_reg_write_intent(struct kts1622_chip *chip, u8 reg_addr,
+				    u8 reg_val)
+{
+	int ret;
+
+	if (reg_val == chip->reg_cache[reg_addr])
+		return 0;
+
+	ret = kts1622_reg_write(chip, reg_addr, reg_val);
+	if (ret < 0) {
+		dev_err_ratelimited(&chip->client->dev,
+				    "failed to write 0x%02X: %d, deferred\n",
+				    reg_addr, ret);
+		chip->reg_cache[reg_addr] = reg_val;
+		kts1622_recover_schedule(chip);
+	}
+
+	return ret;
+}
+
+/* Run the interrupt handler without an interrupt, in its usual context */
+static void kts1622_irq_poll(struct kts1622_chip *chip)
+{
+	if (chip->worker.irq_fn)
+		kthread_queue_work(chip->worker.worker, &chip->worker.poll_work);
+	else if (chip->client->irq && chip->irq_base != -1)
+		irq_wake_thread(chip->client->irq,
+				chip->irq_group ? (void *)chip->irq_group : chip);
+}
+
+static void kts1622_recover_work(struct work_struct *work)
+{
+	struct kts1622_chip *chip = container_of(work, struct kts1622_chip,
+						 err.recover_work);
+	/* Behind a mux only the root adapter knows how to recover the bus. */
+	struct i2c_adapter *adapter = i2c_root_adapter(&chip->client->dev);
+	int ret;
+
+	i2c_lock_bus(adapter, I2C_LOCK_ROOT_ADAPTER);
+	ret = i2c_recover_bus(adapter);
+	i2c_unlock_bus(adapter, I2C_LOCK_ROOT_ADAPTER);
+	if (ret == 0)
+		atomic_inc(&chip->err.recoveries);
+	else if (ret != -EOPNOTSUPP)
+		dev_warn_ratelimited(&chip->client->dev,
+				     "bus recovery failed: %d\n", ret);
+
+	/* The chip may have been reset while the bus was stuck. */
+	mutex_lock(&chip->i2c_lock);
+	ret = kts1622_cache_sync(chip);
+	mutex_unlock(&chip->i2c_lock);
+	if (ret < 0) {
+		/* The next run of failures tries again. */
+		atomic_set(&chip->err.failed, 0);
+		return;
+	}
+
+	atomic_inc(&chip->err.resyncs);
+
+	/* Interrupts raised meanwhile are still flagged in INTERRUPT_STATUS. */
+	kts1622_irq_poll(chip);
+}
+
+/*
+ * Transfers keep failing while the chip goes away, from the interrupt, the PWM
+ * thread or gpiolib, so recovery is shut off before it is cancelled.
+ */
+static void kts1622_recover_stop(struct kts1622_chip *chip)
+{
+	spin_lock(&chip->err.lock);
+	chip->err.dying = true;
+	spin_unlock(&chip->err.lock);
+
+	cancel_work_sync(&chip->err.recover_work);
+}
+
+/* Runtime PM references for lines and channels in use */
+static int kts1622_pm_get(struct kts1622_chip *chip)
+{
+	int ret;
+
+	if (!chip->pm.runtime)
+		return 0;
+
+	ret = pm_runtime_get_sync(&chip->client->dev);
+	if (ret < 0) {
+		pm_runtime_put_noidle(&chip->client->dev);
+		return ret;
+	}
+
+	return 0;
+}
+
+static void kts1622_pm_put(struct kts1622_chip *chip)
+{
+	if (!chip->pm.runtime)
+		return;
+
+	pm_runtime_mark_last_busy(&chip->client->dev);
+	pm_runtime_put_autosuspend(&chip->client->dev);
+}
+
+static bool kts1622_latch_enabled(struct kts1622_chip *chip)
+{
+	return chip->reg_cache[KTS1622_INPUT_LATCH_0] ||
+	       (chip->nports > 1 && chip->reg_cache[KTS1622_INPUT_LATCH_1]);
+}
+
+/*
+ * A latched input holds the level that raised the interrupt until INPUT is
+ * read, which the handler does. Keep those values so a consumer woken by the
+ * interrupt still sees a pulse that is already over.
+ */
+static void kts1622_latch_capture(struct kts1622_chip *chip,
+				  const u8 *irq_status, const u8 *input)
+{
+	int port;
+
+	mutex_lock(&chip->i2c_lock);
+	for (port = 0; port < chip->nports; port++) {
+		u8 m = irq_status[port] &
+		       chip->reg_cache[KTS1622_INPUT_LATCH_0 + port];
+
+		chip->latch_val[port] = (chip->latch_val[port] & ~m) |
+					(input[port] & m);
+		chip->latch_pending[port] |= m;
+	}
+	mutex_unlock(&chip->i2c_lock);
+}
+
+/* Replace the lines in mask by their latched values, once. Needs i2c_lock. */
+static u8 kts1622_latch_take(struct kts1622_chip *chip, int port, u8 mask,
+			     u8 input)
+{
+	u8 m = chip->latch_pending[port] & mask;
+
+	chip->latch_pending[port] &= ~m;
+
+	return (input & ~m) | (chip->latch_val[port] & m);
+}
+
+static int kts1622_gpio_get_value(struct gpio_chip *gc, unsigned offset)
+{
+	struct kts1622_chip *chip = gpiochip_get_data(gc);
+	int port = offset / 8;
+	int pin = offset % 8;
+	u8 reg_val;
+	int ret;
+
+	mutex_lock(&chip->i2c_lock);
+	ret = kts1622_reg_read(chip, KTS1622_INPUT_0 + port, &reg_val);
+	if (ret >= 0)
+		reg_val = kts1622_latch_take(chip, port, BIT(pin), reg_val);
+	mutex_unlock(&chip->i2c_lock);
+	if (ret < 0)
+		return ret;
+
+	return !!(reg_val & (1 << pin));
+}
+
+/* All ports in one block read */
+static int kts1622_gpio_get_multiple(struct gpio_chip *gc, unsigned long *mask,
+				     unsigned long *bits)
+{
+	struct kts1622_chip *chip = gpiochip_get_data(gc);
+	u8 input[NUM_PORTS];
+	int port;
+	int ret;
+
+	mutex_lock(&chip->i2c_lock);
+	ret = kts1622_reg_read_block(chip, KTS1622_INPUT_0, chip->nports, input);
+	if (ret >= 0) {
+		for (port = 0; port < chip->nports; port++) {
+			unsigned int start = port * NUM_PINS_PER_PORT;
+			u8 m = bitmap_get_value8(mask, start);
+			u8 b = bitmap_get_value8(bits, start);
+
+			input[port] = kts1622_latch_take(chip, port, m, input[port]);
+			bitmap_set_value8(bits, (b & ~m) | (input[port] & m), start);
+		}
+	}
+	mutex_unlock(&chip->i2c_lock);
+
+	return ret < 0 ? ret : 0;
+}
+
+static void kts1622_gpio_set_value(struct gpio_chip *gc, unsigned offset, int val)
+{
+	struct kts1622_chip *chip = gpiochip_get_data(gc);
+	int port = offset / 8;
+	int pin = offset % 8;
+	u8 reg_addr = KTS1622_OUTPUT_0 + port;
+	u8 reg_val;
+
+	mutex_lock(&chip->i2c_lock);
+	reg_val = chip->reg_cache[reg_addr] & ~BIT(pin);
+	kts1622_reg_write_intent(chip, reg_addr, reg_val | (val ? BIT(pin) : 0));
+	mutex_unlock(&chip->i2c_lock);
+}
+
+static int kts1622_gpio_set_direction(struct gpio_chip *gc, unsigned offset, int direction)
+{
+	struct kts1622_chip *chip = gpiochip_get_data(gc);
+	int port = offset / 8;
+	int pin = offset % 8;
+	u8 reg_addr = KTS1622_CONFIG_0 + port;
+	int ret;
+
+	mutex_lock(&chip->i2c_lock);
+
+	if (direction == PIN_OUTPUT)
 		ret = kts1622_reg_bit_set(chip, reg_addr, pin, 0);
-	else if (config == PIN_CONFIG_DRIVE_PUSH_PULL)
+	else
 		ret = kts1622_reg_bit_set(chip, reg_addr, pin, 1);
 
 	mutex_unlock(&chip->i2c_lock);
 
-	return ret;
+	return ret;
+}
+
+/*
+ * irq_edge[] holds the requested edges of the line value the driver reports.
+ * The chip detects edges on the pin, so rising and falling are swapped for the
+ * lines whose reported value is inverted by POLARITY_INVERSION.
+ */
+static u8 kts1622_irq_edge_swap(u8 polarity, int reg, u8 edge)
+{
+	u8 inv = polarity >> ((reg % 2) * 4);
+	u8 swap = 0;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		if (inv & BIT(i))
+			swap |= 0x03 << (i * 2);
+
+	return (edge & ~swap) |
+	       ((((edge & 0x55) << 1) | ((edge & 0xAA) >> 1)) & swap);
+}
+
+static u8 kts1622_irq_edge_hw(struct kts1622_chip *chip, int reg)
+{
+	return kts1622_irq_edge_swap(
+			chip->reg_cache[KTS1622_POLARITY_INVERSION_0 + reg / 2],
+			reg, chip->irq_edge[reg]);
+}
+
+/* Edges of the lines the driver keeps armed for itself */
+static u8 kts1622_irq_edge_armed(struct kts1622_chip *chip, int reg)
+{
+	return chip->encoders.edge[reg] | chip->reflex.edge[reg] |
+	       chip->watch_edge[reg];
+}
+
+static int kts1622_irq_edge_write(struct kts1622_chip *chip, int reg)
+{
+	return kts1622_reg_write_intent(chip, KTS1622_INTERRUPT_EDGE_0A + reg,
+					kts1622_irq_edge_hw(chip, reg) |
+					kts1622_irq_edge_armed(chip, reg));
+}
+
+static int kts1622_gpio_request(struct gpio_chip *gc, unsigned offset)
+{
+	return kts1622_pm_get(gpiochip_get_data(gc));
+}
+
+static void kts1622_gpio_free(struct gpio_chip *gc, unsigned offset)
+{
+	kts1622_pm_put(gpiochip_get_data(gc));
+}
+
+static int kts1622_gpio_direction_input(struct gpio_chip *gc, unsigned offset)
+{
+	return kts1622_gpio_set_direction(gc, offset, PIN_INPUT);
+}
+
+static int kts1622_gpio_direction_output(struct gpio_chip *gc, unsigned offset, int val)
+{
+	/* Set output value. */
+	kts1622_gpio_set_value(gc, offset, val);
+
+	/* Then, set output mode. */
+	return kts1622_gpio_set_direction(gc, offset, PIN_OUTPUT);
+}
+
+static int kts1622_gpio_get_direction(struct gpio_chip *gc, unsigned offset)
+{
+	struct kts1622_chip *chip = gpiochip_get_data(gc);
+	int port = offset / 8;
+	int pin = offset % 8;
+	u8 reg_addr = KTS1622_CONFIG_0 + port;
+	u8 reg_val;
+
+	/*
+	 * CONFIG only changes through us, so the shadow is authoritative. This
+	 * also keeps gpiochip registration from reading every line's direction.
+	 */
+	mutex_lock(&chip->i2c_lock);
+	reg_val = chip->reg_cache[reg_addr];
+	mutex_unlock(&chip->i2c_lock);
+
+	return !!(reg_val & (1 << pin));
+}
+
+static int kts1622_gpio_set_pull_up_down(struct kts1622_chip *chip,
+					 unsigned int offset,
+					 unsigned long config)
+{
+	int port = offset / 8;
+	int pin = offset % 8;
+	u8 reg_en_addr = KTS1622_PULLUP_DOWN_ENABLE_0 + port;
+	u8 reg_sel_addr = KTS1622_PULLUP_DOWN_SELECTION_0 + port;
+	int ret;
+
+	mutex_lock(&chip->i2c_lock);
+
+	/* Disable pull-up/pull-down */
+	ret = kts1622_reg_bit_set(chip, reg_en_addr, pin, PULL_UP_DOWN_DISABLE);
+	if (ret < 0)
+		goto exit;
+
+	/* Configure pull-up/pull-down */
+	if (config == PIN_CONFIG_BIAS_PULL_UP) {
+		ret = kts1622_reg_bit_set(chip, reg_sel_addr, pin, PULL_UP);
+		if (ret < 0)
+			goto exit;
+		ret = kts1622_reg_bit_set(chip, reg_en_addr, pin, PULL_UP_DOWN_ENABLE);
+
+	} else if (config == PIN_CONFIG_BIAS_PULL_DOWN) {
+		ret = kts1622_reg_bit_set(chip, reg_sel_addr, pin, PULL_DOWN);
+		if (ret < 0)
+			goto exit;
+		ret = kts1622_reg_bit_set(chip, reg_en_addr, pin, PULL_UP_DOWN_ENABLE);
+
+	} else if (config == PIN_CONFIG_BIAS_DISABLE) {
+		ret = kts1622_reg_bit_set(chip, reg_en_addr, pin, PULL_UP_DOWN_DISABLE);
+	}
+
+	if (ret)
+		goto exit;
+exit:
+	mutex_unlock(&chip->i2c_lock);
+	return ret;
+}
+
+static int kts1622_gpio_set_open_drain(struct kts1622_chip *chip,
+					 unsigned int offset,
+					 unsigned long config)
+{
+	int port = offset / 8;
+	int pin = offset % 8;
+	u8 reg_addr = KTS1622_INDIVIDUAL_PIN_OUTPUT_0 + port;
+	int ret;
+
+	mutex_lock(&chip->i2c_lock);
+
+	/* Configure Open-drain/Push-pull */
+	if (config == PIN_CONFIG_DRIVE_OPEN_DRAIN)
+		ret = kts1622_reg_bit_set(chip, reg_addr, pin, 0);
+	else if (config == PIN_CONFIG_DRIVE_PUSH_PULL)
+		ret = kts1622_reg_bit_set(chip, reg_addr, pin, 1);
+
+	mutex_unlock(&chip->i2c_lock);
+
+	return ret;
+}
+
+static u8 kts1622_drive_strength_reg(unsigned int offset)
+{
+	return KTS1622_DRIVE_STRENGTH_0A + offset / 4;
+}
+
+static int kts1622_drive_strength_shift(unsigned int offset)
+{
+	return (offset % 4) * 2;
+}
+
+/*
+ * Drive strengths are in mA, from DT and PIN_CONFIG_DRIVE_STRENGTH alike.
+ * Each level is a quarter of full drive, the nearest one is taken; currents
+ * the chip cannot drive are refused.
+ */
+static int kts1622_drive_strength_level(u32 ma)
+{
+	if (!ma || ma > DRIVE_STRENGTH_FULL_MA)
+		return -ENOTSUPP;
+
+	return clamp(DIV_ROUND_CLOSEST(ma * (DRIVE_STRENGTH_FULL + 1),
+				       DRIVE_STRENGTH_FULL_MA), 1U,
+		     DRIVE_STRENGTH_FULL + 1U) - 1;
+}
+
+static int kts1622_gpio_set_drive_strength(struct kts1622_chip *chip,
+					   unsigned int offset, u32 ma)
+{
+	u8 reg_addr = kts1622_drive_strength_reg(offset);
+	int shift = kts1622_drive_strength_shift(offset);
+	int level = kts1622_drive_strength_level(ma);
+	u8 reg_val;
+	int ret = 0;
+
+	if (level < 0)
+		return level;
+
+	mutex_lock(&chip->i2c_lock);
+
+	reg_val = chip->reg_cache[reg_addr] & ~(DRIVE_STRENGTH_MASK << shift);
+	reg_val |= level << shift;
+	if (reg_val != chip->reg_cache[reg_addr])
+		ret = kts1622_reg_write(chip, reg_addr, reg_val);
+
+	mutex_unlock(&chip->i2c_lock);
+
+	return ret;
+}
+
+static int kts1622_gpio_set_config(struct gpio_chip *gc, unsigned int offset,
+				   unsigned long config)
+{
+	struct kts1622_chip *chip = gpiochip_get_data(gc);
+
+	switch (pinconf_to_config_param(config)) {
+	case PIN_CONFIG_BIAS_PULL_UP:
+	case PIN_CONFIG_BIAS_PULL_DOWN:
+		return kts1622_gpio_set_pull_up_down(chip, offset, config);
+
+	case PIN_CONFIG_DRIVE_OPEN_DRAIN:
+	case PIN_CONFIG_DRIVE_PUSH_PULL:
+		return kts1622_gpio_set_open_drain(chip, offset, config);
+
+	case PIN_CONFIG_DRIVE_STRENGTH:
+		return kts1622_gpio_set_drive_strength(chip, offset,
+				pinconf_to_config_argument(config));
+
+	default:
+		return -ENOTSUPP;
+	}
+}
+
+static void kts1622_irq_mask(struct irq_data *d)
+{
+	struct gpio_chip *gc = irq_data_get_irq_chip_data(d);
+	struct kts1622_chip *chip = gpiochip_get_data(gc);
+	int port = d->hwirq / 8;
+	int pin = d->hwirq % 8;
+
+	chip->irq_mask[port] |= 1 << pin;
+}
+
+static void kts1622_irq_unmask(struct irq_data *d)
+{
+	struct gpio_chip *gc = irq_data_get_irq_chip_data(d);
+	struct kts1622_chip *chip = gpiochip_get_data(gc);
+	int port = d->hwirq / 8;
+	int pin = d->hwirq % 8;
+
+	chip->irq_mask[port] &= ~(1 << pin);
+}
+
+static void kts1622_irq_bus_lock(struct irq_data *d)
+{
+	struct gpio_chip *gc = irq_data_get_irq_chip_data(d);
+	struct kts1622_chip *chip = gpiochip_get_data(gc);
+
+	mutex_lock(&chip->irq_lock);
+}
+
+/*
+ * Encoder, reflex and pattern lines always stay armed, throttled lines may be
+ * held masked.
+ */
+static u8 kts1622_irq_mask_hw(struct kts1622_chip *chip, int port)
+{
+	return (chip->irq_mask[port] | READ_ONCE(chip->irq_rl.masked[port])) &
+	       ~(chip->encoders.pins[port] | chip->reflex.pins[port] |
+		 chip->watch_pins[port]);
+}
+
+static int kts1622_irq_mask_write(struct kts1622_chip *chip, int port)
+{
+	return kts1622_reg_write_intent(chip, KTS1622_INTERRUPT_MASK_0 + port,
+					kts1622_irq_mask_hw(chip, port));
+}
+
+static void kts1622_irq_bus_sync_unlock(struct irq_data *d)
+{
+	struct gpio_chip *gc = irq_data_get_irq_chip_data(d);
+	struct kts1622_chip *chip = gpiochip_get_data(gc);
+	int port;
+
+	/* Synchronize the register value */
+	for (port=0; port<chip->nports; port++) {
+		kts1622_irq_mask_write(chip, port);
+		kts1622_irq_edge_write(chip, port*2);
+		kts1622_irq_edge_write(chip, port*2 + 1);
+	}
+
+	mutex_unlock(&chip->irq_lock);
+}
+
+static int kts1622_irq_set_type(struct irq_data *d, unsigned int type)
+{
+	struct gpio_chip *gc = irq_data_get_irq_chip_data(d);
+	struct kts1622_chip *chip = gpiochip_get_data(gc);
+	struct i2c_client *client = chip->client;
+	u8 val;
+
+	switch (type) {
+	case IRQ_TYPE_EDGE_RISING:
+		val = 0x01;
+		break;
+
+	case IRQ_TYPE_EDGE_FALLING:
+		val = 0x02;
+		break;
+
+	case IRQ_TYPE_EDGE_BOTH:
+		val = 0x03;
+		break;
+
+	case IRQ_TYPE_LEVEL_LOW:
+	case IRQ_TYPE_LEVEL_HIGH:
+		val = 0x00;
+		break;
+
+	default:
+		dev_err(&client->dev, "unsupported irq type: %u\n", type);
+		return -EINVAL;
+	}
+
+	chip->irq_edge[d->hwirq/4] &= ~(0x03 << ((d->hwirq % 4) * 2));
+	chip->irq_edge[d->hwirq/4] |= val << ((d->hwirq % 4) * 2);
+
+	return 0;
+}
+
+static int kts1622_irq_request_resources(struct irq_data *d)
+{
+	struct gpio_chip *gc = irq_data_get_irq_chip_data(d);
+	struct kts1622_chip *chip = gpiochip_get_data(gc);
+	int ret;
+
+	ret = gpiochip_reqres_irq(gc, d->hwirq);
+	if (ret)
+		return ret;
+
+	ret = kts1622_pm_get(chip);
+	if (ret)
+		gpiochip_relres_irq(gc, d->hwirq);
+
+	return ret;
+}
+
+static void kts1622_irq_release_resources(struct irq_data *d)
+{
+	struct gpio_chip *gc = irq_data_get_irq_chip_data(d);
+	struct kts1622_chip *chip = gpiochip_get_data(gc);
+
+	kts1622_pm_put(chip);
+	gpiochip_relres_irq(gc, d->hwirq);
+}
+
+static void kts1622_irq_shutdown(struct irq_data *d)
+{
+	struct gpio_chip *gc = irq_data_get_irq_chip_data(d);
+	struct kts1622_chip *chip = gpiochip_get_data(gc);
+
+	chip->irq_edge[d->hwirq/4] &= ~(0x03 << ((d->hwirq % 4) * 2));
+}
+
+/*
+ * Quadrature decoding: index is (previous AB << 2) | current AB. Transitions
+ * where both lines changed cannot be decoded and count as errors.
+ */
+static const s8 kts1622_quad_table[16] = {
+	0, -1, 1, 0,
+	1, 0, 0, -1,
+	-1, 0, 0, 1,
+	0, 1, -1, 0,
+};
+
+static const unsigned int kts1622_encoder_axes[NUM_PINS / 2] = {
+	REL_X, REL_Y, REL_Z, REL_RX, REL_RY, REL_RZ, REL_HWHEEL, REL_DIAL,
+};
+
+static inline bool kts1622_input_bit(const u8 *input, unsigned int pin)
+{
+	return input[pin / NUM_PINS_PER_PORT] & BIT(pin % NUM_PINS_PER_PORT);
+}
+
+static inline u8 kts1622_encoder_ab(struct kts1622_encoder *enc, const u8 *input)
+{
+	return (kts1622_input_bit(input, enc->pin_a) << 1) |
+	       kts1622_input_bit(input, enc->pin_b);
+}
+
+/* Decode all encoders from the INPUT bytes read by the interrupt handler. */
+static void kts1622_encoder_update(struct kts1622_chip *chip, const u8 *input)
+{
+	struct kts1622_encoders *encs = &chip->encoders;
+	bool report = false;
+	int i;
+
+	for (i = 0; i < encs->num; i++) {
+		struct kts1622_encoder *enc = &encs->enc[i];
+		u8 ab = kts1622_encoder_ab(enc, input);
+		u8 idx = (enc->state << 2) | ab;
+		int detents;
+
+		if (ab == enc->state)
+			continue;
+
+		if ((enc->state ^ ab) == 0x03)
+			enc->errors++;
+
+		enc->state = ab;
+		enc->accum += kts1622_quad_table[idx];
+
+		detents = enc->accum / (int)encs->steps;
+		if (!detents)
+			continue;
+
+		enc->accum -= detents * (int)encs->steps;
+		enc->count += detents;
+		input_report_rel(encs->input, kts1622_encoder_axes[i], detents);
+		report = true;
+	}
+
+	if (report)
+		input_sync(encs->input);
+}
+
+static int kts1622_encoder_setup(struct kts1622_chip *chip)
+{
+	struct kts1622_encoders *encs = &chip->encoders;
+	struct device *dev = &chip->client->dev;
+	struct input_dev *input;
+	u32 pins[NUM_PINS];
+	u8 input_val[NUM_PORTS];
+	int count;
+	int i;
+	int ret;
+
+	count = device_property_count_u32(dev, "kinetic_technologies,encoders");
+	if (count <= 0)
+		return 0;
+
+	if (count % 2 || count > chip->gpio_chip.ngpio) {
+		dev_err(dev, "invalid encoder pin list\n");
+		return -EINVAL;
+	}
+
+	ret = device_property_read_u32_array(dev, "kinetic_technologies,encoders",
+					     pins, count);
+	if (ret)
+		return ret;
+
+	encs->steps = 4;
+	device_property_read_u32(dev, "kinetic_technologies,encoder-steps",
+				 &encs->steps);
+	if (!encs->steps)
+		encs->steps = 1;
+
+	input = devm_input_allocate_device(dev);
+	if (!input)
+		return -ENOMEM;
+
+	input->name = "kts1622-encoders";
+	input->phys = "kts1622-encoders/input0";
+	input->id.bustype = BUS_I2C;
+	input->dev.parent = dev;
+
+	for (i = 0; i < count; i++) {
+		if (pins[i] >= chip->gpio_chip.ngpio) {
+			dev_err(dev, "invalid encoder pin %u\n", pins[i]);
+			return -EINVAL;
+		}
+		encs->pins[pins[i] / NUM_PINS_PER_PORT] |= BIT(pins[i] % NUM_PINS_PER_PORT);
+		/* Both edges, whatever the consumers of the line ask for. */
+		encs->edge[pins[i] / 4] |= 0x03 << ((pins[i] % 4) * 2);
+	}
+
+	mutex_lock(&chip->i2c_lock);
+	ret = kts1622_reg_read_block(chip, KTS1622_INPUT_0, chip->nports, input_val);
+	for (i = 0; i < chip->nports && ret == 0; i++) {
+		u8 edge[2] = {
+			chip->irq_edge[i * 2] | encs->edge[i * 2],
+			chip->irq_edge[i * 2 + 1] | encs->edge[i * 2 + 1],
+		};
+
+		ret = kts1622_reg_write_block(chip, KTS1622_INTERRUPT_EDGE_0A + i * 2,
+					      2, edge);
+		if (ret == 0)
+			ret = kts1622_reg_write(chip, KTS1622_INTERRUPT_MASK_0 + i,
+						chip->irq_mask[i] & ~encs->pins[i]);
+	}
+	mutex_unlock(&chip->i2c_lock);
+	if (ret < 0)
+		return ret;
+
+	encs->num = count / 2;
+	for (i = 0; i < encs->num; i++) {
+		struct kts1622_encoder *enc = &encs->enc[i];
+
+		enc->pin_a = pins[i * 2];
+		enc->pin_b = pins[i * 2 + 1];
+		enc->state = kts1622_encoder_ab(enc, input_val);
+		input_set_capability(input, EV_REL, kts1622_encoder_axes[i]);
+	}
+
+	ret = input_register_device(input);
+	if (ret) {
+		dev_err(dev, "failed to register encoder input device\n");
+		encs->num = 0;
+		return ret;
+	}
+	encs->input = input;
+
+	return 0;
+}
+
+/*
+ * Read the interrupt status and, when encoders are decoded, the input port in
+ * one combined transfer.
+ */
+static int kts1622_irq_read_state(struct kts1622_chip *chip, u8 *irq_status,
+				  u8 *input)
+{
+	struct i2c_client *i2c = chip->client;
+	u8 status_reg = KTS1622_INTERRUPT_STATUS_0;
+	u8 input_reg = KTS1622_INPUT_0;
+	struct i2c_msg msgs[] = {
+		{ .addr = i2c->addr, .len = 1, .buf = &status_reg },
+		{ .addr = i2c->addr, .flags = I2C_M_RD, .len = chip->nports, .buf = irq_status },
+		{ .addr = i2c->addr, .len = 1, .buf = &input_reg },
+		{ .addr = i2c->addr, .flags = I2C_M_RD, .len = chip->nports, .buf = input },
+	};
+	int nmsgs = input ? 4 : 2;
+	int attempt = 0;
+	u64 first;
+	u64 start;
+	int ret;
+
+	if (!chip->xfer.raw) {
+		ret = kts1622_reg_read_block(chip, KTS1622_INTERRUPT_STATUS_0,
+					     chip->nports, irq_status);
+		if (ret < 0 || !input)
+			return ret;
+		return kts1622_reg_read_block(chip, KTS1622_INPUT_0, chip->nports,
+					      input);
+	}
+
+	first = ktime_get_ns();
+	do {
+		start = kts1622_trace_start();
+		ret = i2c_transfer(i2c->adapter, msgs, nmsgs);
+		if (ret >= 0)
+			ret = ret == nmsgs ? 0 : -EIO;
+
+		kts1622_trace_record(chip, start, KTS1622_TRACE_READ,
+				     KTS1622_XFER_RAW, status_reg, chip->nports,
+				     irq_status, ret);
+		if (input)
+			kts1622_trace_record(chip, start,
+					     KTS1622_TRACE_READ | KTS1622_TRACE_CONT,
+					     KTS1622_XFER_RAW, input_reg,
+					     chip->nports, input, ret);
+	} while (ret < 0 && kts1622_xfer_retry(chip, ret, attempt++, first));
+
+	return kts1622_xfer_done(chip, ret);
+}
+
+/*
+ * Rate limit: a line may dispatch burst events per interval, further events
+ * are dropped (and the line optionally masked in hardware) until the release
+ * ends the throttling with one event carrying the line's final state. The
+ * release runs in the interrupt servicing context, woken by a timer, so it
+ * never races the handler for the same lines.
+ */
+static bool kts1622_irq_rl_allow(struct kts1622_chip *chip, int port, int pin)
+{
+	struct kts1622_irq_rl *rl = &chip->irq_rl;
+	unsigned int line = port * NUM_PINS_PER_PORT + pin;
+	u64 now = ktime_get_ns();
+	bool mask = false;
+	bool allow;
+
+	spin_lock(&rl->lock);
+	if (now - rl->window[line] >= (u64)rl->interval_ms * NSEC_PER_MSEC) {
+		rl->window[line] = now;
+		rl->count[line] = 0;
+	}
+
+	allow = rl->count[line] < rl->burst;
+	if (allow) {
+		rl->count[line]++;
+	} else {
+		rl->dropped[line]++;
+		rl->throttled[port] |= BIT(pin);
+		if (rl->mask && !(rl->masked[port] & BIT(pin))) {
+			rl->masked[port] |= BIT(pin);
+			mask = true;
+		}
+		if (!rl->pending && !rl->dying) {
+			rl->pending = true;
+			rl->release_at = jiffies + msecs_to_jiffies(rl->interval_ms);
+			mod_timer(&rl->release_timer, rl->release_at);
+		}
+	}
+	spin_unlock(&rl->lock);
+
+	if (allow)
+		return true;
+
+	if (mask) {
+		mutex_lock(&chip->i2c_lock);
+		kts1622_irq_mask_write(chip, port);
+		mutex_unlock(&chip->i2c_lock);
+	}
+
+	return false;
+}
+
+static void kts1622_irq_rl_timer(struct timer_list *t)
+{
+	struct kts1622_chip *chip = from_timer(chip, t, irq_rl.release_timer);
+
+	kts1622_irq_poll(chip);
+}
+
+/* Called by the interrupt servicing before it reads the status */
+static void kts1622_irq_rl_release(struct kts1622_chip *chip)
+{
+	struct kts1622_irq_rl *rl = &chip->irq_rl;
+	u8 throttled[NUM_PORTS];
+	u8 masked[NUM_PORTS];
+	int port;
+	int pin;
+
+	if (!READ_ONCE(rl->pending))
+		return;
+
+	spin_lock(&rl->lock);
+	if (!rl->pending || time_before(jiffies, rl->release_at)) {
+		spin_unlock(&rl->lock);
+		return;
+	}
+	rl->pending = false;
+	memcpy(throttled, rl->throttled, sizeof(throttled));
+	memcpy(masked, rl->masked, sizeof(masked));
+	memset(rl->throttled, 0, sizeof(rl->throttled));
+	memset(rl->masked, 0, sizeof(rl->masked));
+	spin_unlock(&rl->lock);
+
+	mutex_lock(&chip->i2c_lock);
+	for (port = 0; port < chip->nports; port++)
+		if (masked[port])
+			kts1622_irq_mask_write(chip, port);
+	mutex_unlock(&chip->i2c_lock);
+
+	/* Consumers read the line level, the last dropped edge is not lost. */
+	for (port = 0; port < chip->nports; port++) {
+		unsigned long status = throttled[port];
+
+		for_each_set_bit(pin, &status, NUM_PINS_PER_PORT)
+			handle_nested_irq(irq_find_mapping(chip->gpio_chip.irq.domain,
+							   port * NUM_PINS_PER_PORT + pin));
+	}
+}
+
+static void kts1622_irq_rl_stop(struct kts1622_chip *chip)
+{
+	struct kts1622_irq_rl *rl = &chip->irq_rl;
+
+	spin_lock(&rl->lock);
+	rl->dying = true;
+	spin_unlock(&rl->lock);
+
+	del_timer_sync(&rl->release_timer);
+}
+
+/* Physical levels of all lines, bit n is line n */
+static u16 kts1622_input_word(struct kts1622_chip *chip, const u8 *input)
+{
+	u16 in = 0;
+	int port;
+
+	for (port = 0; port < chip->nports; port++)
+		in |= (input[port] ^
+		       chip->reg_cache[KTS1622_POLARITY_INVERSION_0 + port]) <<
+		      (port * NUM_PINS_PER_PORT);
+
+	return in;
+}
+
+/*
+ * Evaluate the reflex rules, write the outputs they change in one block write.
+ * Needs i2c_lock.
+ */
+static void __kts1622_reflex_eval(struct kts1622_chip *chip, const u8 *input,
+				  u64 t0)
+{
+	struct kts1622_reflex *rx = &chip->reflex;
+	u8 out[NUM_PORTS];
+	u16 changed = 0;
+	u16 set_mask = 0;
+	u16 set_val = 0;
+	u16 in;
+	unsigned long active;
+	u64 lat;
+	int port;
+	int i;
+	int ret;
+
+	in = kts1622_input_word(chip, input);
+
+	/* Later rules win on outputs driven by several rules. */
+	active = rx->active;
+	for_each_set_bit(i, &active, KTS1622_REFLEX_MAX) {
+		struct kts1622_reflex_rule *r = &rx->rule[i];
+		u16 val = (in & r->in_mask) == r->in_match ? r->out_val : r->out_else;
+
+		set_val = (set_val & ~r->out_mask) | (val & r->out_mask);
+		set_mask |= r->out_mask;
+		r->evals++;
+	}
+
+	for (port = 0; port < chip->nports; port++) {
+		u8 m = set_mask >> (port * NUM_PINS_PER_PORT);
+		u8 v = set_val >> (port * NUM_PINS_PER_PORT);
+
+		out[port] = (chip->reg_cache[KTS1622_OUTPUT_0 + port] & ~m) | (v & m);
+		changed |= (out[port] ^ chip->reg_cache[KTS1622_OUTPUT_0 + port]) <<
+			   (port * NUM_PINS_PER_PORT);
+	}
+	if (!changed)
+		return;
+
+	ret = kts1622_reg_write_block(chip, KTS1622_OUTPUT_0, chip->nports, out);
+	if (ret < 0)
+		return;
+
+	lat = ktime_get_ns() - t0;
+	for_each_set_bit(i, &active, KTS1622_REFLEX_MAX) {
+		struct kts1622_reflex_rule *r = &rx->rule[i];
+
+		if (!(r->out_mask & changed))
+			continue;
+		r->reactions++;
+		r->last_ns = lat;
+		r->total_ns += lat;
+		if (lat > r->max_ns)
+			r->max_ns = lat;
+	}
+}
+
+static void kts1622_reflex_eval(struct kts1622_chip *chip, const u8 *input,
+				u64 t0)
+{
+	mutex_lock(&chip->i2c_lock);
+	__kts1622_reflex_eval(chip, input, t0);
+	mutex_unlock(&chip->i2c_lock);
+}
+
+static inline bool kts1622_pattern_waiting(struct kts1622_chip *chip)
+{
+	return chip->pattern && !list_empty(&chip->pattern->waiters);
+}
+
+/* Complete the waiters whose pattern the new snapshot of the inputs matches */
+static void kts1622_pattern_update(struct kts1622_chip *chip, const u8 *input,
+				   u64 ts)
+{
+	struct kts1622_pattern *pat = chip->pattern;
+	struct kts1622_pattern_waiter *w, *tmp;
+	u16 in = kts1622_input_word(chip, input);
+
+	spin_lock(&pat->lock);
+	list_for_each_entry_safe(w, tmp, &pat->waiters, node) {
+		if ((in & w->mask) != w->value)
+			continue;
+		w->input = in;
+		w->ts = ts;
+		list_del_init(&w->node);
+		complete(&w->done);
+	}
+	spin_unlock(&pat->lock);
+}
+
+/* Clear and dispatch the interrupts flagged in irq_status[]. */
+static int kts1622_irq_dispatch(struct kts1622_chip *chip, u8 *irq_status,
+				const u8 *input, u64 t0)
+{
+	bool pattern = kts1622_pattern_waiting(chip);
+	bool encoders = false;
+	bool reflex = false;
+	u8 buf[NUM_PORTS];
+	int nhandled = 0;
+	int port = 0;
+	int pin = 0;
+
+	for (port = 0; port < chip->nports; port++)
+		reflex |= irq_status[port] & chip->reflex.pins[port];
+
+	/* Grouped interrupts only read the status. */
+	if (!input && (reflex || pattern)) {
+		mutex_lock(&chip->i2c_lock);
+		if (kts1622_reg_read_block(chip, KTS1622_INPUT_0, chip->nports,
+					   buf) == 0)
+			input = buf;
+		mutex_unlock(&chip->i2c_lock);
+	}
+
+	if (reflex && input)
+		kts1622_reflex_eval(chip, input, t0);
+	if (pattern && input)
+		kts1622_pattern_update(chip, input, t0);
+
+	/*
+	 * Clear the interrupt flags. Lines still flagged are reported by the
+	 * next run of the handler, dispatching them now would report them twice.
+	 */
+	if (kts1622_reg_write_block(chip, KTS1622_INTERRUPT_CLEAR_0,
+				    chip->nports, irq_status) < 0) {
+		dev_err_ratelimited(&chip->client->dev,
+				    "failed to clear interrupts\n");
+		kts1622_recover_schedule(chip);
+		return 1;
+	}
+
+	for (port = 0; port < chip->nports; port++) {
+		encoders |= irq_status[port] & chip->encoders.pins[port];
+		irq_status[port] &= ~chip->encoders.pins[port];
+		/* Reflex and pattern lines nobody else asked interrupts for */
+		irq_status[port] &= ~((chip->reflex.pins[port] |
+				       chip->watch_pins[port]) &
+				      chip->irq_mask[port]);
+	}
+
+	if (input && encoders) {
+		kts1622_encoder_update(chip, input);
+		nhandled++;
+	}
+
+	/* Only visit the pins that fired. */
+	for (port = 0; port < chip->nports; port++) {
+		unsigned long status = irq_status[port];
+
+		for_each_set_bit(pin, &status, NUM_PINS_PER_PORT) {
+			nhandled++;
+			if (chip->irq_rl.burst &&
+			    !kts1622_irq_rl_allow(chip, port, pin))
+				continue;
+			handle_nested_irq(irq_find_mapping(chip->gpio_chip.irq.domain, port * NUM_PINS_PER_PORT + pin));
+		}
+	}
+
+	return nhandled;
+}
+
+static irqreturn_t kts1622_irq_handler(int irq, void *devid)
+{
+	struct kts1622_chip *chip = devid;
+	u8 irq_status[NUM_PORTS];
+	u8 input[NUM_PORTS];
+	bool latched = kts1622_latch_enabled(chip);
+	bool decode = chip->encoders.num > 0 || latched || chip->reflex.active ||
+		      kts1622_pattern_waiting(chip);
+	u64 t0 = READ_ONCE(chip->worker.kick_ns);
+	int ret;
+
+	WRITE_ONCE(chip->irq_task, current);
+	WRITE_ONCE(chip->worker.kick_ns, 0);
+	if (!t0)
+		t0 = ktime_get_ns();
+
+	kts1622_irq_rl_release(chip);
+
+	/* Read to check which line is the cause of the interrupt */
+	ret = kts1622_irq_read_state(chip, irq_status, decode ? input : NULL);
+	if (ret < 0)
+		return IRQ_NONE;
+
+	/* Not ours, on a shared line this is the only transfer we cost. */
+	if (!memchr_inv(irq_status, 0, chip->nports))
+		return IRQ_NONE;
+
+	if (latched)
+		kts1622_latch_capture(chip, irq_status, input);
+
+	return kts1622_irq_dispatch(chip, irq_status, decode ? input : NULL, t0) ?
+		IRQ_HANDLED : IRQ_NONE;
+}
+
+/*
+ * Bus workers: one kthread_worker per root adapter, shared by the chips behind
+ * it, so that the parts of a multi-chip operation on different buses run
+ * concurrently. Chips behind a mux share the worker of the root adapter,
+ * they cannot use the bus at the same time anyway.
+ */
+static LIST_HEAD(kts1622_buses);
+static DEFINE_MUTEX(kts1622_buses_lock);
+
+static struct kts1622_bus *kts1622_bus_get(struct kts1622_chip *chip)
+{
+	struct i2c_adapter *adapter = i2c_root_adapter(&chip->client->dev);
+	struct kts1622_bus *bus;
+
+	mutex_lock(&kts1622_buses_lock);
+
+	list_for_each_entry(bus, &kts1622_buses, node)
+		if (bus->adapter == adapter)
+			goto found;
+
+	bus = kzalloc(sizeof(*bus), GFP_KERNEL);
+	if (!bus) {
+		bus = ERR_PTR(-ENOMEM);
+		goto exit;
+	}
+
+	bus->adapter = adapter;
+	bus->worker = kthread_create_worker(0, "kts1622-bus/%d", adapter->nr);
+	if (IS_ERR(bus->worker)) {
+		struct kthread_worker *worker = bus->worker;
+
+		kfree(bus);
+		bus = ERR_CAST(worker);
+		goto exit;
+	}
+	list_add(&bus->node, &kts1622_buses);
+found:
+	/*
+	 * Opt-in: the same class as the interrupt thread it takes work from,
+	 * as soon as any chip on the bus asks for it.
+	 */
+	if (!bus->fifo && device_property_read_bool(&chip->client->dev,
+						    "kinetic_technologies,bus-worker-fifo")) {
+		sched_set_fifo(bus->worker->task);
+		bus->fifo = true;
+	}
+	bus->users++;
+exit:
+	mutex_unlock(&kts1622_buses_lock);
+	return bus;
+}
+
+static void kts1622_bus_put(struct kts1622_bus *bus)
+{
+	mutex_lock(&kts1622_buses_lock);
+	if (--bus->users == 0) {
+		list_del(&bus->node);
+		kthread_destroy_worker(bus->worker);
+		kfree(bus);
+	}
+	mutex_unlock(&kts1622_buses_lock);
+}
+
+static void kts1622_bus_op_work(struct kthread_work *work)
+{
+	struct kts1622_bus_op *op = container_of(work, struct kts1622_bus_op,
+						 work);
+	struct kts1622_bus_sync *sync = op->sync;
+
+	op->fn(op);
+	if (atomic_dec_and_test(&sync->pending))
+		complete(&sync->done);
+}
+
+/*
+ * Run the parts of a multi-chip operation, one per bus, and wait for all of
+ * them. The first part runs in the caller's context, the others on the
+ * workers of their buses.
+ */
+static void kts1622_bus_run(struct kts1622_bus_op *ops, int nops)
+{
+	struct kts1622_bus_sync sync;
+	int i;
+
+	if (!nops)
+		return;
+
+	atomic_set(&sync.pending, nops);
+	init_completion(&sync.done);
+
+	for (i = 0; i < nops; i++) {
+		ops[i].sync = &sync;
+		kthread_init_work(&ops[i].work, kts1622_bus_op_work);
+	}
+	for (i = 1; i < nops; i++)
+		kthread_queue_work(ops[i].bus->worker, &ops[i].work);
+
+	kts1622_bus_op_work(&ops[0].work);
+	wait_for_completion(&sync.done);
+}
+
+/*
+ * Interrupt groups: several chips with their INT outputs wired together on
+ * one host interrupt. A single handler services the whole group and reads
+ * the status of all chips on the same adapter in one i2c_transfer. Chips on
+ * different buses are serviced concurrently on the bus workers.
+ */
+static LIST_HEAD(kts1622_irq_groups);
+static DEFINE_MUTEX(kts1622_irq_groups_lock);
+
+static int kts1622_irq_group_service(struct kts1622_chip **batch, int n)
+{
+	struct kts1622_chip *owners[KTS1622_IRQ_GROUP_MAX * 2];
+	struct i2c_msg msgs[KTS1622_IRQ_GROUP_MAX * 2];
+	u8 irq_status[KTS1622_IRQ_GROUP_MAX][NUM_PORTS];
+	u8 status_reg = KTS1622_INTERRUPT_STATUS_0;
+	int nhandled = 0;
+	u64 t0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		kts1622_irq_rl_release(batch[i]);
+		owners[i * 2] = batch[i];
+		owners[i * 2 + 1] = batch[i];
+		msgs[i * 2].addr = batch[i]->client->addr;
+		msgs[i * 2].flags = 0;
+		msgs[i * 2].len = 1;
+		msgs[i * 2].buf = &status_reg;
+		msgs[i * 2 + 1].addr = batch[i]->client->addr;
+		msgs[i * 2 + 1].flags = I2C_M_RD;
+		msgs[i * 2 + 1].len = batch[i]->nports;
+		msgs[i * 2 + 1].buf = irq_status[i];
+	}
+
+	t0 = ktime_get_ns();
+	if (kts1622_xfer_msgs(owners, msgs, n * 2) < 0) {
+		/* One chip not answering must not starve the others. */
+		for (i = 0; i < n; i++)
+			if (kts1622_irq_handler(0, batch[i]) == IRQ_HANDLED)
+				nhandled++;
+		return nhandled;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!memchr_inv(irq_status[i], 0, batch[i]->nports))
+			continue;
+		if (kts1622_irq_dispatch(batch[i], irq_status[i], NULL, t0))
+			nhandled++;
+	}
+
+	return nhandled;
+}
+
+/*
+ * Encoders and latched lines need the input port as well, so such chips are
+ * serviced in their own handler.
+ */
+static bool kts1622_irq_group_batchable(struct kts1622_chip *chip)
+{
+	return !chip->encoders.num && !kts1622_latch_enabled(chip) &&
+	       chip->xfer.raw;
+}
+
+/*
+ * Service the chips of the group on one bus (all chips not serviced yet if bus
+ * is NULL). Chips on other buses are skipped before their flags are looked
+ * at, another worker owns those.
+ */
+static int kts1622_irq_group_pass(struct kts1622_irq_group *group, int irq,
+				  struct kts1622_bus *bus)
+{
+	struct kts1622_chip *batch[KTS1622_IRQ_GROUP_MAX];
+	struct kts1622_chip *chip;
+	struct kts1622_chip *other;
+	int nhandled = 0;
+	int n;
+
+	list_for_each_entry(chip, &group->chips, irq_group_node) {
+		struct i2c_adapter *adapter = chip->client->adapter;
+
+		if ((bus && chip->bus != bus) || chip->irq_group_done)
+			continue;
+
+		WRITE_ONCE(chip->irq_task, current);
+
+		if (!kts1622_irq_group_batchable(chip)) {
+			chip->irq_group_done = true;
+			if (kts1622_irq_handler(irq, chip) == IRQ_HANDLED)
+				nhandled++;
+			continue;
+		}
+
+		n = 0;
+		other = chip;
+		list_for_each_entry_from(other, &group->chips, irq_group_node) {
+			if (other->client->adapter != adapter ||
+			    other->irq_group_done ||
+			    !kts1622_irq_group_batchable(other))
+				continue;
+
+			WRITE_ONCE(other->irq_task, current);
+			other->irq_group_done = true;
+			batch[n++] = other;
+			if (n == KTS1622_IRQ_GROUP_MAX)
+				break;
+		}
+
+		nhandled += kts1622_irq_group_service(batch, n);
+	}
+
+	return nhandled;
+}
+
+static void kts1622_irq_group_bus_op(struct kts1622_bus_op *op)
+{
+	op->result = kts1622_irq_group_pass(op->data, op->irq, op->bus);
+}
+
+static irqreturn_t kts1622_irq_group_handler(int irq, void *devid)
+{
+	struct kts1622_irq_group *group = devid;
+	struct kts1622_bus_op ops[KTS1622_IRQ_GROUP_MAX];
+	struct kts1622_chip *chip;
+	int nhandled = 0;
+	int nops = 0;
+	int i;
+
+	mutex_lock(&group->lock);
+
+	list_for_each_entry(chip, &group->chips, irq_group_node) {
+		chip->irq_group_done = false;
+
+		for (i = 0; i < nops; i++)
+			if (ops[i].bus == chip->bus)
+				break;
+		if (i < nops || nops == KTS1622_IRQ_GROUP_MAX)
+			continue;
+
+		ops[nops++] = (struct kts1622_bus_op) {
+			.bus = chip->bus,
+			.fn = kts1622_irq_group_bus_op,
+			.data = group,
+			.irq = irq,
+		};
+	}
+
+	kts1622_bus_run(ops, nops);
+	for (i = 0; i < nops; i++)
+		nhandled += ops[i].result;
+
+	/* Buses beyond the ops array, serviced one after the other */
+	nhandled += kts1622_irq_group_pass(group, irq, NULL);
+
+	mutex_unlock(&group->lock);
+
+	return (nhandled > 0) ? IRQ_HANDLED : IRQ_NONE;
+}
+
+static int kts1622_irq_group_join(struct kts1622_chip *chip)
+{
+	struct i2c_client *client = chip->client;
+	struct kts1622_irq_group *group;
+	struct kts1622_bus *bus;
+	int ret = 0;
+
+	bus = kts1622_bus_get(chip);
+	if (IS_ERR(bus))
+		return PTR_ERR(bus);
+
+	mutex_lock(&kts1622_irq_groups_lock);
+
+	list_for_each_entry(group, &kts1622_irq_groups, node)
+		if (group->irq == client->irq)
+			goto join;
+
+	group = kzalloc(sizeof(*group), GFP_KERNEL);
+	if (!group) {
+		ret = -ENOMEM;
+		goto exit;
+	}
+
+	INIT_LIST_HEAD(&group->chips);
+	mutex_init(&group->lock);
+	group->irq = client->irq;
+
+	ret = request_threaded_irq(client->irq, NULL, kts1622_irq_group_handler,
+				   IRQF_ONESHOT | IRQF_SHARED, "kts1622-group",
+				   group);
+	if (ret) {
+		dev_err(&client->dev, "failed to request irq %d\n", client->irq);
+		kfree(group);
+		goto exit;
+	}
+	list_add(&group->node, &kts1622_irq_groups);
+
+join:
+	mutex_lock(&group->lock);
+	chip->bus = bus;
+	list_add_tail(&chip->irq_group_node, &group->chips);
+	mutex_unlock(&group->lock);
+	chip->irq_group = group;
+exit:
+	mutex_unlock(&kts1622_irq_groups_lock);
+	if (ret)
+		kts1622_bus_put(bus);
+	return ret;
+}
+
+static void kts1622_irq_group_leave(struct kts1622_chip *chip)
+{
+	struct kts1622_irq_group *group = chip->irq_group;
+	bool empty;
+
+	if (!group)
+		return;
+
+	mutex_lock(&kts1622_irq_groups_lock);
+
+	mutex_lock(&group->lock);
+	list_del(&chip->irq_group_node);
+	empty = list_empty(&group->chips);
+	mutex_unlock(&group->lock);
+	chip->irq_group = NULL;
+
+	if (empty) {
+		list_del(&group->node);
+		free_irq(group->irq, group);
+		kfree(group);
+	}
+
+	mutex_unlock(&kts1622_irq_groups_lock);
+
+	kts1622_bus_put(chip->bus);
+	chip->bus = NULL;
+}
+
+/*
+ * Interrupt servicing on the chip's own worker. The hard handler masks the
+ * parent line and queues the work, which runs the usual threaded handler and
+ * unmasks the line again. An edge arriving meanwhile is replayed by the irq
+ * core on enable_irq().
+ */
+static irqreturn_t kts1622_irq_kick(int irq, void *devid)
+{
+	struct kts1622_chip *chip = devid;
+
+	WRITE_ONCE(chip->worker.kick_ns, ktime_get_ns());
+	disable_irq_nosync(irq);
+	kthread_queue_work(chip->worker.worker, &chip->worker.irq_work);
+
+	return IRQ_HANDLED;
+}
+
+static void kts1622_irq_work(struct kthread_work *work)
+{
+	struct kts1622_chip *chip = container_of(work, struct kts1622_chip,
+						 worker.irq_work);
+
+	chip->worker.irq_fn(chip->client->irq, chip);
+	enable_irq(chip->client->irq);
+}
+
+static void kts1622_poll_work(struct kthread_work *work)
+{
+	struct kts1622_chip *chip = container_of(work, struct kts1622_chip,
+						 worker.poll_work);
+
+	chip->worker.irq_fn(chip->client->irq, chip);
+}
+
+/* Scheduling class and CPUs of a thread doing I/O for this chip */
+static void kts1622_worker_apply(struct kts1622_chip *chip,
+				 struct task_struct *task)
+{
+	struct kts1622_worker *w = &chip->worker;
+
+	switch (w->sched) {
+	case KTS1622_SCHED_FIFO:
+		sched_set_fifo(task);
+		break;
+	case KTS1622_SCHED_FIFO_LOW:
+		sched_set_fifo_low(task);
+		break;
+	default:
+		sched_set_normal(task, 0);
+		break;
+	}
+
+	set_cpus_allowed_ptr(task, &w->cpus);
+}
+
+static void kts1622_worker_destroy(void *data)
+{
+	kthread_destroy_worker(data);
+}
+
+static int kts1622_worker_setup(struct kts1622_chip *chip)
+{
+	struct kts1622_worker *w = &chip->worker;
+	struct device *dev = &chip->client->dev;
+	const char *sched = NULL;
+	const char *cpus = NULL;
+	int ret;
+
+	device_property_read_string(dev, "kinetic_technologies,worker-sched",
+				    &sched);
+	device_property_read_string(dev, "kinetic_technologies,worker-cpus",
+				    &cpus);
+	if (!sched && !cpus)
+		return 0;
+
+	w->sched = KTS1622_SCHED_FIFO;
+	if (sched) {
+		ret = match_string(kts1622_sched_names,
+				   ARRAY_SIZE(kts1622_sched_names), sched);
+		if (ret < 0) {
+			dev_err(dev, "invalid worker-sched \"%s\"\n", sched);
+			return ret;
+		}
+		w->sched = ret;
+	}
+
+	cpumask_copy(&w->cpus, cpu_possible_mask);
+	if (cpus && (cpulist_parse(cpus, &w->cpus) ||
+		     !cpumask_intersects(&w->cpus, cpu_online_mask))) {
+		dev_err(dev, "invalid worker-cpus \"%s\"\n", cpus);
+		return -EINVAL;
+	}
+
+	kthread_init_work(&w->irq_work, kts1622_irq_work);
+	kthread_init_work(&w->poll_work, kts1622_poll_work);
+	w->worker = kthread_create_worker(0, "kts1622/%s", dev_name(dev));
+	if (IS_ERR(w->worker)) {
+		ret = PTR_ERR(w->worker);
+		w->worker = NULL;
+		return ret;
+	}
+
+	/* Released after the interrupt, which is requested later. */
+	ret = devm_add_action_or_reset(dev, kts1622_worker_destroy, w->worker);
+	if (ret) {
+		w->worker = NULL;
+		return ret;
+	}
+
+	kts1622_worker_apply(chip, w->worker->task);
+
+	return 0;
+}
+
+/* Wait for interrupt work already queued, the parent line is masked */
+static void kts1622_worker_flush(struct kts1622_chip *chip)
+{
+	if (!chip->worker.irq_fn)
+		return;
+
+	kthread_flush_work(&chip->worker.irq_work);
+	kthread_flush_work(&chip->worker.poll_work);
+}
+
+/* Nothing may run on the worker once the irq domain goes away */
+static void kts1622_worker_stop(struct kts1622_chip *chip)
+{
+	if (!chip->worker.irq_fn)
+		return;
+
+	disable_irq(chip->client->irq);
+	kthread_flush_work(&chip->worker.irq_work);
+	kthread_cancel_work_sync(&chip->worker.poll_work);
+}
+
+/*
+ * Request the parent interrupt for fn, on the worker when there is one. A
+ * shared line stays with the irq core: masking it for the duration of our
+ * I/O would delay the other devices on it.
+ */
+static int kts1622_request_irq(struct kts1622_chip *chip, irq_handler_t fn)
+{
+	struct i2c_client *client = chip->client;
+	int ret;
+
+	if (chip->worker.worker && !chip->irq_shared) {
+		chip->worker.irq_fn = fn;
+		ret = devm_request_any_context_irq(&client->dev, client->irq,
+						   kts1622_irq_kick, 0,
+						   dev_name(&client->dev), chip);
+		if (ret < 0)
+			chip->worker.irq_fn = NULL;
+	} else {
+		ret = devm_request_threaded_irq(&client->dev, client->irq,
+						NULL, fn,
+						IRQF_ONESHOT |
+						(chip->irq_shared ? IRQF_SHARED : 0),
+						dev_name(&client->dev), chip);
+	}
+
+	if (ret < 0) {
+		dev_err(&client->dev, "failed to request irq %d\n", client->irq);
+		return ret;
+	}
+
+	return 0;
+}
+
+static int kts1622_irq_setup(struct kts1622_chip *chip)
+{
+	struct i2c_client *client = chip->client;
+	struct irq_chip *irq_chip = &chip->irq_chip;
+	u32 rl_limit[2];
+	int ret;
+
+	if (!client->irq)
+		return 0;
+
+	if (chip->irq_base == -1)
+		return 0;
+
+	irq_chip->name = dev_name(&chip->client->dev);
+	irq_chip->irq_mask = kts1622_irq_mask;
+	irq_chip->irq_unmask = kts1622_irq_unmask;
+	irq_chip->irq_bus_lock = kts1622_irq_bus_lock;
+	irq_chip->irq_bus_sync_unlock = kts1622_irq_bus_sync_unlock;
+	irq_chip->irq_set_type = kts1622_irq_set_type;
+	irq_chip->irq_shutdown = kts1622_irq_shutdown;
+	irq_chip->irq_request_resources = kts1622_irq_request_resources;
+	irq_chip->irq_release_resources = kts1622_irq_release_resources;
+
+	/* The shadow already holds the reset or adopted values. */
+	memcpy(chip->irq_mask, &chip->reg_cache[KTS1622_INTERRUPT_MASK_0],
+	       sizeof(chip->irq_mask));
+	memcpy(chip->irq_edge, &chip->reg_cache[KTS1622_INTERRUPT_EDGE_0A],
+	       sizeof(chip->irq_edge));
+
+	ret = kts1622_encoder_setup(chip);
+	if (ret)
+		return ret;
+
+	/* <burst> or <burst interval-ms>, one second by default */
+	rl_limit[1] = 1000;
+	if (!device_property_read_u32_array(&client->dev,
+					    "kinetic_technologies,irq-rate-limit",
+					    rl_limit, 2) ||
+	    !device_property_read_u32(&client->dev,
+				      "kinetic_technologies,irq-rate-limit",
+				      &rl_limit[0])) {
+		chip->irq_rl.burst = rl_limit[0];
+		chip->irq_rl.interval_ms = rl_limit[1];
+	}
+	chip->irq_rl.mask = device_property_read_bool(&client->dev,
+				"kinetic_technologies,irq-rate-limit-mask");
+
+	if (!device_property_read_bool(&client->dev, "kinetic_technologies,irq-group")) {
+		ret = kts1622_request_irq(chip, kts1622_irq_handler);
+		if (ret)
+			return ret;
+	}
+
+	ret =  gpiochip_irqchip_add_nested(&chip->gpio_chip, irq_chip,
+					   chip->irq_base, handle_simple_irq,
+					   IRQ_TYPE_NONE);
+	if (ret) {
+		dev_err(&client->dev,
+			"could not connect irqchip to gpiochip\n");
+		return ret;
+	}
+
+	gpiochip_set_nested_irqchip(&chip->gpio_chip, irq_chip, client->irq);
+
+	/* Grouped chips are serviced once the irq domain exists. */
+	if (device_property_read_bool(&client->dev, "kinetic_technologies,irq-group"))
+		return kts1622_irq_group_join(chip);
+
+	return 0;
+}
+
+#if IS_ENABLED(CONFIG_PWM)
+static inline struct kts1622_chip *pwm_to_kts1622(struct pwm_chip *pc)
+{
+	return container_of(pc, struct kts1622_chip, pwm.chip);
+}
+
+/*
+ * Write the PWM-owned bits of both ports in a single OUTPUT_0/1 block write.
+ * Ownership is checked under i2c_lock so a channel that was just disabled is
+ * never overwritten by a period that was already in flight.
+ */
+static int kts1622_pwm_write(struct kts1622_chip *chip, u16 level)
+{
+	u8 buf[NUM_PORTS];
+	u16 owned;
+	int port;
+	int ret;
+
+	mutex_lock(&chip->i2c_lock);
+	owned = chip->pwm.enabled;
+	for (port = 0; port < chip->nports; port++) {
+		u8 mask = owned >> (port * NUM_PINS_PER_PORT);
+		u8 bits = level >> (port * NUM_PINS_PER_PORT);
+
+		buf[port] = (chip->reg_cache[KTS1622_OUTPUT_0 + port] & ~mask) |
+			    (bits & mask);
+	}
+	ret = kts1622_reg_write_block(chip, KTS1622_OUTPUT_0, chip->nports, buf);
+	chip->pwm.writes++;
+	mutex_unlock(&chip->i2c_lock);
+
+	return ret;
+}
+
+static void kts1622_pwm_sleep_until(struct kts1622_pwm *pwm, ktime_t expires)
+{
+	if (ktime_after(ktime_get(), expires)) {
+		pwm->overruns++;
+		return;
+	}
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	schedule_hrtimeout_range(&expires, KTS1622_PWM_SLACK_NS, HRTIMER_MODE_ABS);
+}
+
+/*
+ * Run one PWM period. All channels share the period, so every channel turns
+ * active at the start of the period and each distinct duty cycle adds a single
+ * transition. That bounds the bus load to (1 + distinct duty values) block
+ * writes per period regardless of the number of channels.
+ */
+static void kts1622_pwm_run_period(struct kts1622_chip *chip, ktime_t start)
+{
+	struct kts1622_pwm *pwm = &chip->pwm;
+	u64 duty_ns[NUM_PINS];
+	u64 period_ns;
+	unsigned long enabled;
+	u16 inversed;
+	u16 active = 0;
+	int i;
+
+	mutex_lock(&pwm->lock);
+	period_ns = pwm->period_ns;
+	enabled = pwm->enabled;
+	inversed = pwm->inversed;
+	memcpy(duty_ns, pwm->duty_ns, sizeof(duty_ns));
+	pwm->changed = false;
+	mutex_unlock(&pwm->lock);
+
+	for_each_set_bit(i, &enabled, NUM_PINS)
+		if (duty_ns[i])
+			active |= BIT(i);
+
+	/* Start of period: channels with a non-zero duty cycle go active. */
+	if (ktime_before(ktime_get(), start)) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_hrtimeout_range(&start, KTS1622_PWM_SLACK_NS,
+					 HRTIMER_MODE_ABS);
+	}
+	kts1622_pwm_write(chip, active ^ inversed);
+
+	for (;;) {
+		u64 next = period_ns;
+		u16 falling = 0;
+
+		unsigned long pending = active;
+
+		for_each_set_bit(i, &pending, NUM_PINS) {
+			if (duty_ns[i] >= period_ns)
+				continue;
+			if (duty_ns[i] < next) {
+				next = duty_ns[i];
+				falling = BIT(i);
+			} else if (duty_ns[i] == next) {
+				falling |= BIT(i);
+			}
+		}
+
+		kts1622_pwm_sleep_until(pwm, ktime_add_ns(start, next));
+
+		if (!falling || kthread_should_stop() || READ_ONCE(pwm->changed))
+			break;
+
+		active &= ~falling;
+		kts1622_pwm_write(chip, active ^ inversed);
+	}
+
+	pwm->periods++;
+}
+
+static int kts1622_pwm_thread(void *data)
+{
+	struct kts1622_chip *chip = data;
+	struct kts1622_pwm *pwm = &chip->pwm;
+	ktime_t start = ktime_get();
+
+	/* Frozen across system suspend, the outputs hold their last level. */
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		if (try_to_freeze())
+			start = ktime_get();
+
+		if (!READ_ONCE(pwm->enabled)) {
+			wait_event_freezable(pwm->wait,
+					READ_ONCE(pwm->enabled) ||
+					kthread_should_stop());
+			start = ktime_get();
+			continue;
+		}
+
+		kts1622_pwm_run_period(chip, start);
+
+		start = ktime_add_ns(start, READ_ONCE(pwm->period_ns));
+		/* Resynchronize instead of bursting after a long stall. */
+		if (ktime_after(ktime_get(), start))
+			start = ktime_get();
+	}
+
+	return 0;
+}
+
+static int kts1622_pwm_request(struct pwm_chip *pc, struct pwm_device *pwm)
+{
+	struct kts1622_chip *chip = pwm_to_kts1622(pc);
+
+	if (gpiochip_is_requested(&chip->gpio_chip, pwm->hwpwm))
+		return -EBUSY;
+
+	return kts1622_pm_get(chip);
+}
+
+static void kts1622_pwm_free(struct pwm_chip *pc, struct pwm_device *pwm)
+{
+	kts1622_pm_put(pwm_to_kts1622(pc));
+}
+
+static int kts1622_pwm_apply(struct pwm_chip *pc, struct pwm_device *pwm,
+			     const struct pwm_state *state)
+{
+	struct kts1622_chip *chip = pwm_to_kts1622(pc);
+	struct kts1622_pwm *kpwm = &chip->pwm;
+	unsigned int ch = pwm->hwpwm;
+	u16 others;
+	u64 step;
+	int ret = 0;
+
+	mutex_lock(&kpwm->lock);
+
+	others = kpwm->enabled & ~BIT(ch);
+
+	if (!state->enabled) {
+		mutex_lock(&chip->i2c_lock);
+		kpwm->enabled &= ~BIT(ch);
+		mutex_unlock(&chip->i2c_lock);
+		kpwm->changed = true;
+		mutex_unlock(&kpwm->lock);
+
+		/* Park the line at its inactive level. */
+		kts1622_gpio_set_value(&chip->gpio_chip, ch,
+				       state->polarity == PWM_POLARITY_INVERSED);
+		return 0;
+	}
+
+	if (state->period < KTS1622_PWM_MIN_PERIOD_NS) {
+		ret = -EINVAL;
+		goto exit;
+	}
+
+	/* All channels share one period, like a common prescaler. */
+	if (others && kpwm->period_ns != state->period) {
+		ret = -EBUSY;
+		goto exit;
+	}
+
+	/*
+	 * Quantize the duty cycle so channels with nearly equal duty cycles
+	 * share a transition, and with it an OUTPUT block write.
+	 */
+	step = div_u64(state->period, KTS1622_PWM_STEPS);
+	kpwm->duty_ns[ch] = div64_u64(state->duty_cycle + step / 2, step) * step;
+	if (kpwm->duty_ns[ch] > state->period)
+		kpwm->duty_ns[ch] = state->period;
+
+	if (state->polarity == PWM_POLARITY_INVERSED)
+		kpwm->inversed |= BIT(ch);
+	else
+		kpwm->inversed &= ~BIT(ch);
+
+	if (!kpwm->thread) {
+		struct task_struct *thread;
+
+		thread = kthread_run(kts1622_pwm_thread, chip, "kts1622-pwm/%s",
+				     dev_name(pc->dev));
+		if (IS_ERR(thread)) {
+			ret = PTR_ERR(thread);
+			goto exit;
+		}
+		kpwm->thread = thread;
+
+		if (chip->worker.worker) {
+			mutex_lock(&chip->worker.lock);
+			kts1622_worker_apply(chip, thread);
+			mutex_unlock(&chip->worker.lock);
+		}
+	}
+
+	if (!(kpwm->enabled & BIT(ch))) {
+		ret = kts1622_gpio_set_direction(&chip->gpio_chip, ch, PIN_OUTPUT);
+		if (ret < 0)
+			goto exit;
+	}
+
+	if (!kpwm->enabled) {
+		kpwm->start = ktime_get();
+		kpwm->writes = 0;
+		kpwm->periods = 0;
+		kpwm->overruns = 0;
+	}
+
+	kpwm->period_ns = state->period;
+	mutex_lock(&chip->i2c_lock);
+	kpwm->enabled |= BIT(ch);
+	mutex_unlock(&chip->i2c_lock);
+	kpwm->changed = true;
+	wake_up_interruptible(&kpwm->wait);
+
+exit:
+	mutex_unlock(&kpwm->lock);
+	return ret;
+}
+
+static void kts1622_pwm_get_state(struct pwm_chip *pc, struct pwm_device *pwm,
+				  struct pwm_state *state)
+{
+	struct kts1622_chip *chip = pwm_to_kts1622(pc);
+	struct kts1622_pwm *kpwm = &chip->pwm;
+	unsigned int ch = pwm->hwpwm;
+
+	mutex_lock(&kpwm->lock);
+	state->enabled = !!(kpwm->enabled & BIT(ch));
+	state->period = kpwm->period_ns;
+	state->duty_cycle = kpwm->duty_ns[ch];
+	state->polarity = (kpwm->inversed & BIT(ch)) ?
+			  PWM_POLARITY_INVERSED : PWM_POLARITY_NORMAL;
+	mutex_unlock(&kpwm->lock);
+}
+
+static const struct pwm_ops kts1622_pwm_ops = {
+	.request = kts1622_pwm_request,
+	.free = kts1622_pwm_free,
+	.apply = kts1622_pwm_apply,
+	.get_state = kts1622_pwm_get_state,
+	.owner = THIS_MODULE,
+};
+
+static int kts1622_pwm_setup(struct kts1622_chip *chip)
+{
+	struct kts1622_pwm *kpwm = &chip->pwm;
+	struct i2c_client *client = chip->client;
+	int ret;
+
+	mutex_init(&kpwm->lock);
+	init_waitqueue_head(&kpwm->wait);
+
+	kpwm->chip.dev = &client->dev;
+	kpwm->chip.ops = &kts1622_pwm_ops;
+	kpwm->chip.npwm = chip->gpio_chip.ngpio;
+	kpwm->chip.base = -1;
+
+	ret = pwmchip_add(&kpwm->chip);
+	if (ret) {
+		dev_err(&client->dev, "failed to register pwm chip\n");
+		return ret;
+	}
+	kpwm->registered = true;
+
+	return 0;
+}
+
+static void kts1622_pwm_teardown(struct kts1622_chip *chip)
+{
+	struct kts1622_pwm *kpwm = &chip->pwm;
+
+	if (!kpwm->registered)
+		return;
+
+	pwmchip_remove(&kpwm->chip);
+	if (kpwm->thread)
+		kthread_stop(kpwm->thread);
+	kpwm->thread = NULL;
+}
+
+static void kts1622_pwm_debug_show(struct seq_file *s, struct kts1622_chip *chip)
+{
+	struct kts1622_pwm *kpwm = &chip->pwm;
+	u64 elapsed_ns;
+	u64 rate = 0;
+
+	if (!kpwm->enabled)
+		return;
+
+	elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), kpwm->start));
+	if (elapsed_ns)
+		rate = div64_u64(kpwm->writes * NSEC_PER_SEC, elapsed_ns);
+
+	seq_printf(s, "pwm: period %llu ns, channels 0x%04X\n",
+		   kpwm->period_ns, kpwm->enabled);
+	seq_printf(s, " writes %llu (%llu/s), periods %llu, overruns %llu\n",
+		   kpwm->writes, rate, kpwm->periods, kpwm->overruns);
+}
+#else
+static inline int kts1622_pwm_setup(struct kts1622_chip *chip)
+{
+	return 0;
+}
+
+static inline void kts1622_pwm_teardown(struct kts1622_chip *chip)
+{
+}
+
+static inline void kts1622_pwm_debug_show(struct seq_file *s,
+					  struct kts1622_chip *chip)
+{
+}
+#endif /* CONFIG_PWM */
+
+/*
+ * Keypad matrix mode: one port drives the columns, the other reads the rows.
+ * The chip scans with whole-port CONFIG writes and one INPUT read per column
+ * and only starts scanning when a row interrupt fires.
+ */
+static int kts1622_keypad_set_irq(struct kts1622_chip *chip, bool enable)
+{
+	struct kts1622_keypad *kp = &chip->keypad;
+
+	/* Only the row bits, other lines on the row port keep their mask. */
+	return kts1622_reg_update_bits(chip,
+				       KTS1622_INTERRUPT_MASK_0 + kp->row_port,
+				       kp->row_mask, enable ? 0 : 0xFF);
+}
+
+static void kts1622_keypad_scan(struct work_struct *work)
+{
+	struct kts1622_keypad *kp = container_of(to_delayed_work(work),
+						 struct kts1622_keypad, work);
+	struct kts1622_chip *chip = container_of(kp, struct kts1622_chip, keypad);
+	struct input_dev *input = kp->input;
+	const unsigned short *keycodes = input->keycode;
+	u8 col_port = !kp->row_port;
+	u8 config_reg = KTS1622_CONFIG_0 + col_port;
+	u8 state[NUM_PINS_PER_PORT];
+	u8 pressed = 0;
+	u8 others;
+	u8 reg_val;
+	int col;
+	int row;
+	int ret = 0;
+
+	mutex_lock(&chip->i2c_lock);
+
+	/* Pins of the column port that are not columns keep their direction. */
+	others = chip->reg_cache[config_reg] & ~kp->col_mask;
+
+	for (col = 0; col < kp->cols && ret == 0; col++) {
+		/* Only the scanned column drives low, the others float. */
+		ret = kts1622_reg_write(chip, config_reg,
+					others | (kp->col_mask & ~BIT(col)));
+		if (ret < 0)
+			break;
+
+		if (kp->col_delay_us)
+			udelay(kp->col_delay_us);
+
+		ret = kts1622_reg_read(chip, KTS1622_INPUT_0 + kp->row_port,
+				       &reg_val);
+		state[col] = ~reg_val & kp->row_mask;
+		pressed |= state[col];
+	}
+
+	/* Drive all columns low again so any key press raises an interrupt. */
+	kts1622_reg_write(chip, config_reg, others);
+
+	mutex_unlock(&chip->i2c_lock);
+
+	if (ret < 0) {
+		dev_err(&chip->client->dev, "keypad scan failed (%d)\n", ret);
+		goto rearm;
+	}
+
+	for (col = 0; col < kp->cols; col++) {
+		u8 changed = state[col] ^ kp->state[col];
+
+		for (row = 0; row < kp->rows; row++) {
+			int code = MATRIX_SCAN_CODE(row, col, kp->row_shift);
+
+			if (!(changed & BIT(row)))
+				continue;
+
+			input_event(input, EV_MSC, MSC_SCAN, code);
+			input_report_key(input, keycodes[code],
+					 state[col] & BIT(row));
+		}
+		kp->state[col] = state[col];
+	}
+	input_sync(input);
+
+	/* Keep polling while keys are held, the row edges are already gone. */
+	if (pressed) {
+		schedule_delayed_work(&kp->work,
+				      msecs_to_jiffies(kp->debounce_ms));
+		return;
+	}
+
+rearm:
+	mutex_lock(&chip->i2c_lock);
+	kts1622_keypad_set_irq(chip, true);
+	mutex_unlock(&chip->i2c_lock);
+}
+
+static irqreturn_t kts1622_keypad_irq(int irq, void *devid)
+{
+	struct kts1622_chip *chip = devid;
+	struct kts1622_keypad *kp = &chip->keypad;
+	u8 irq_status[NUM_PORTS];
+	u8 rows;
+	int ret;
+
+	mutex_lock(&chip->i2c_lock);
+	ret = kts1622_reg_read_block(chip, KTS1622_INTERRUPT_STATUS_0, chip->nports,
+				     irq_status);
+	rows = irq_status[kp->row_port] & kp->row_mask;
+	if (ret < 0 || !rows) {
+		mutex_unlock(&chip->i2c_lock);
+		return IRQ_NONE;
+	}
+
+	/* Only the rows, edges pending on other pins stay flagged. */
+	kts1622_reg_write(chip, KTS1622_INTERRUPT_CLEAR_0 + kp->row_port, rows);
+	/* Scanning toggles the rows, keep the interrupt quiet until done. */
+	kts1622_keypad_set_irq(chip, false);
+	mutex_unlock(&chip->i2c_lock);
+
+	schedule_delayed_work(&kp->work, msecs_to_jiffies(kp->debounce_ms));
+
+	return IRQ_HANDLED;
+}
+
+static int kts1622_keypad_setup(struct kts1622_chip *chip)
+{
+	struct kts1622_keypad *kp = &chip->keypad;
+	struct i2c_client *client = chip->client;
+	struct device *dev = &client->dev;
+	struct input_dev *input;
+	u8 col_port;
+	u8 edge[2] = { 0, 0 };
+	u32 val;
+	int pin;
+	int ret;
+
+	if (!client->irq || chip->nports < 2) {
+		dev_err(dev, "keypad mode requires an interrupt and two ports\n");
+		return -EINVAL;
+	}
+
+	ret = matrix_keypad_parse_properties(dev, &kp->rows, &kp->cols);
+	if (ret)
+		return ret;
+
+	if (kp->rows > NUM_PINS_PER_PORT || kp->cols > NUM_PINS_PER_PORT) {
+		dev_err(dev, "keypad is limited to %dx%d\n",
+			NUM_PINS_PER_PORT, NUM_PINS_PER_PORT);
+		return -EINVAL;
+	}
+
+	kp->row_port = 0;
+	if (!device_property_read_u32(dev, "kinetic_technologies,keypad-rows-port", &val))
+		kp->row_port = !!val;
+	col_port = !kp->row_port;
+
+	kp->debounce_ms = 10;
+	device_property_read_u32(dev, "debounce-delay-ms", &kp->debounce_ms);
+	device_property_read_u32(dev, "col-scan-delay-us", &kp->col_delay_us);
+
+	kp->row_mask = GENMASK(kp->rows - 1, 0);
+	kp->col_mask = GENMASK(kp->cols - 1, 0);
+	kp->row_shift = get_count_order(kp->cols);
+
+	input = devm_input_allocate_device(dev);
+	if (!input)
+		return -ENOMEM;
+
+	input->name = client->name;
+	input->phys = "kts1622-keys/input0";
+	input->id.bustype = BUS_I2C;
+	input->dev.parent = dev;
+
+	ret = matrix_keypad_build_keymap(NULL, NULL, kp->rows, kp->cols,
+					 NULL, input);
+	if (ret) {
+		dev_err(dev, "failed to build keymap\n");
+		return ret;
+	}
+
+	if (!device_property_read_bool(dev, "keypad,no-autorepeat"))
+		__set_bit(EV_REP, input->evbit);
+	input_set_capability(input, EV_MSC, MSC_SCAN);
+
+	kp->input = input;
+	INIT_DELAYED_WORK(&kp->work, kts1622_keypad_scan);
+
+	for (pin = 0; pin < kp->rows; pin++)
+		edge[pin / 4] |= 0x02 << ((pin % 4) * 2);	/* Falling edge */
+
+	mutex_lock(&chip->i2c_lock);
+
+	/* Rows: inputs with pull-ups, falling edge interrupts. */
+	ret = kts1622_reg_write(chip, KTS1622_PULLUP_DOWN_SELECTION_0 + kp->row_port,
+				kp->row_mask);
+	if (ret < 0)
+		goto exit;
+	ret = kts1622_reg_write(chip, KTS1622_PULLUP_DOWN_ENABLE_0 + kp->row_port,
+				kp->row_mask);
+	if (ret < 0)
+		goto exit;
+	ret = kts1622_reg_write_block(chip, KTS1622_INTERRUPT_EDGE_0A + kp->row_port * 2,
+				      2, edge);
+	if (ret < 0)
+		goto exit;
+
+	/* Columns: outputs driving low, the other pins of the port untouched. */
+	ret = kts1622_reg_write(chip, KTS1622_OUTPUT_0 + col_port,
+				chip->reg_cache[KTS1622_OUTPUT_0 + col_port] &
+				~kp->col_mask);
+	if (ret < 0)
+		goto exit;
+	ret = kts1622_reg_write(chip, KTS1622_CONFIG_0 + col_port,
+				chip->reg_cache[KTS1622_CONFIG_0 + col_port] &
+				~kp->col_mask);
+	if (ret < 0)
+		goto exit;
+
+	ret = kts1622_keypad_set_irq(chip, true);
+exit:
+	mutex_unlock(&chip->i2c_lock);
+	if (ret < 0)
+		return ret;
+
+	ret = kts1622_request_irq(chip, kts1622_keypad_irq);
+	if (ret)
+		return ret;
+
+	ret = input_register_device(input);
+	if (ret) {
+		dev_err(dev, "failed to register input device\n");
+		return ret;
+	}
+
+	kp->enabled = true;
+
+	return 0;
+}
+
+static void kts1622_keypad_teardown(struct kts1622_chip *chip)
+{
+	struct kts1622_keypad *kp = &chip->keypad;
+
+	if (!kp->enabled)
+		return;
+
+	disable_irq(chip->client->irq);
+	kts1622_worker_flush(chip);
+	cancel_delayed_work_sync(&kp->work);
+}
+
+/*
+ * Power management. The register shadow is the reference: after a system
+ * resume (or a power-rail drop) the whole configuration is written back in
+ * one block write per register run.
+ */
+static void kts1622_irq_gate(struct kts1622_chip *chip, bool gate)
+{
+	struct i2c_client *client = chip->client;
+
+	/* Other devices depend on a shared line, leave it to the irq core. */
+	if (!client->irq || chip->irq_shared || chip->irq_gated == gate)
+		return;
+
+	if (gate) {
+		disable_irq(client->irq);
+		kts1622_worker_flush(chip);
+	} else {
+		enable_irq(client->irq);
+	}
+	chip->irq_gated = gate;
+}
+
+static int kts1622_restore(struct kts1622_chip *chip)
+{
+	ktime_t start = ktime_get();
+	int ret;
+
+	mutex_lock(&chip->i2c_lock);
+	ret = kts1622_cache_sync(chip);
+	if (ret == 0 && chip->keypad.enabled)
+		ret = kts1622_keypad_set_irq(chip, true);
+	mutex_unlock(&chip->i2c_lock);
+	if (ret < 0)
+		return ret;
+
+	chip->pm.resume_us = ktime_us_delta(ktime_get(), start);
+	chip->pm.resume_max_us = max(chip->pm.resume_max_us, chip->pm.resume_us);
+	chip->pm.resume_count++;
+
+	return 0;
+}
+
+static int __maybe_unused kts1622_suspend(struct device *dev)
+{
+	struct kts1622_chip *chip = dev_get_drvdata(dev);
+
+	kts1622_irq_gate(chip, true);
+	if (chip->keypad.enabled)
+		cancel_delayed_work_sync(&chip->keypad.work);
+
+	return 0;
+}
+
+static int __maybe_unused kts1622_resume(struct device *dev)
+{
+	struct kts1622_chip *chip = dev_get_drvdata(dev);
+	int ret;
+
+	ret = kts1622_restore(chip);
+	if (ret < 0) {
+		dev_err(dev, "failed to restore registers (%d)\n", ret);
+		return ret;
+	}
+
+	if (!pm_runtime_status_suspended(dev))
+		kts1622_irq_gate(chip, false);
+
+	return 0;
+}
+
+/* Runtime PM only gates the interrupt while no line or channel is in use. */
+static int __maybe_unused kts1622_runtime_suspend(struct device *dev)
+{
+	struct kts1622_chip *chip = dev_get_drvdata(dev);
+
+	if (chip->encoders.num || chip->keypad.enabled)
+		return -EBUSY;
+
+	kts1622_irq_gate(chip, true);
+
+	return 0;
+}
+
+static int __maybe_unused kts1622_runtime_resume(struct device *dev)
+{
+	struct kts1622_chip *chip = dev_get_drvdata(dev);
+
+	kts1622_irq_gate(chip, false);
+
+	return 0;
+}
+
+static const struct dev_pm_ops kts1622_pm_ops = {
+	SET_SYSTEM_SLEEP_PM_OPS(kts1622_suspend, kts1622_resume)
+	SET_RUNTIME_PM_OPS(kts1622_runtime_suspend, kts1622_runtime_resume, NULL)
+};
+
+static void kts1622_pm_setup(struct kts1622_chip *chip)
+{
+	struct device *dev = &chip->client->dev;
+
+	/*
+	 * Restore in parallel with the other chips instead of in list order.
+	 * Opt-in: GPIO consumers are not our children, so nothing orders their
+	 * resume after ours except the end of the resume phase.
+	 */
+	if (device_property_read_bool(dev, "kinetic_technologies,async-pm"))
+		device_enable_async_suspend(dev);
+
+	if (!device_property_read_bool(dev, "kinetic_technologies,runtime-pm"))
+		return;
+
+	pm_runtime_set_active(dev);
+	pm_runtime_set_autosuspend_delay(dev, KTS1622_AUTOSUSPEND_DELAY_MS);
+	pm_runtime_use_autosuspend(dev);
+	pm_runtime_enable(dev);
+	chip->pm.runtime = true;
+
+	pm_runtime_mark_last_busy(dev);
+	pm_request_autosuspend(dev);
+}
+
+static void kts1622_pm_teardown(struct kts1622_chip *chip)
+{
+	struct device *dev = &chip->client->dev;
+
+	if (chip->pm.runtime) {
+		pm_runtime_disable(dev);
+		pm_runtime_dont_use_autosuspend(dev);
+		pm_runtime_set_suspended(dev);
+		chip->pm.runtime = false;
+	}
+
+	/* Keep the disable depth balanced before devm frees the interrupt. */
+	kts1622_irq_gate(chip, false);
+}
+
+static void kts1622_debug_show(struct seq_file *s, struct gpio_chip *gc)
+{
+	struct kts1622_chip *chip = gpiochip_get_data(gc);
+	u8 reg_addr;
+	u8 reg_val;
+	int ret;
+	int i;
+
+	seq_printf(s, "%s, %u ports\n", chip->info->name, chip->nports);
+	seq_puts(s, "regs:\n");
+
+	/* The reads refresh the shadow, like every other register access. */
+	mutex_lock(&chip->i2c_lock);
+	for (reg_addr = 0; reg_addr <= 7; reg_addr++) {
+		ret = kts1622_reg_read(chip, reg_addr, &reg_val);
+		if (ret < 0)
+			goto error;
+		seq_printf(s, " 0x%02X: 0x%02X\n", reg_addr, reg_val);
+	}
+	for (reg_addr = 0x40; reg_addr <= 0x5A; reg_addr++) {
+		if (reg_addr == 0x4E)
+			continue; /* Reserved */
+
+		ret = kts1622_reg_read(chip, reg_addr, &reg_val);
+		if (ret < 0)
+			goto error;
+
+		seq_printf(s, " 0x%02X: 0x%02X\n", reg_addr, reg_val);
+	}
+
+	/* Drive levels 0-3 (quarter to full drive), line 0 first */
+	seq_puts(s, "drive strength:");
+	for (i = 0; i < gc->ngpio; i++)
+		seq_printf(s, " %u",
+			   (chip->reg_cache[kts1622_drive_strength_reg(i)] >>
+			    kts1622_drive_strength_shift(i)) & DRIVE_STRENGTH_MASK);
+	mutex_unlock(&chip->i2c_lock);
+	seq_puts(s, "\n");
+
+	for (i = 0; i < chip->encoders.num; i++) {
+		struct kts1622_encoder *enc = &chip->encoders.enc[i];
+
+		seq_printf(s, "encoder%d: pins %u/%u, count %lld, errors %u\n",
+			   i, enc->pin_a, enc->pin_b, enc->count, enc->errors);
+	}
+
+	kts1622_pwm_debug_show(s, chip);
+	return;
+error:
+	mutex_unlock(&chip->i2c_lock);
+	seq_printf(s, "Failed to read KTS1622 registers (ret=%d).", ret);
+}
+
+static void kts1622_setup_gpio(struct kts1622_chip *chip)
+{
+	struct gpio_chip *gc;
+
+	gc = &chip->gpio_chip;
+
+	gc->request = kts1622_gpio_request;
+	gc->free = kts1622_gpio_free;
+	gc->direction_input  = kts1622_gpio_direction_input;
+	gc->direction_output = kts1622_gpio_direction_output;
+	gc->get = kts1622_gpio_get_value;
+	gc->get_multiple = kts1622_gpio_get_multiple;
+	gc->set = kts1622_gpio_set_value;
+	gc->get_direction = kts1622_gpio_get_direction;
+	gc->set_config = kts1622_gpio_set_config;
+	gc->dbg_show = kts1622_debug_show;
+
+	gc->base = -1;
+	gc->can_sleep = true;
+	gc->ngpio = chip->nports * NUM_PINS_PER_PORT;
+	gc->label = dev_name(&chip->client->dev);
+	gc->parent = &chip->client->dev;
+	gc->owner = THIS_MODULE;
+}
+
+/*
+ * Warm attach: adopt whatever configuration the chip already has, e.g. after
+ * a module reload, so the outputs do not glitch. Reads the writable registers
+ * in one block read per register run to seed the shadow.
+ */
+static int device_kts1622_adopt(struct kts1622_chip *chip)
+{
+	int ret = 0;
+	int i;
+
+	mutex_lock(&chip->i2c_lock);
+
+	/*
+	 * Only the writable runs: the status, input and write-only clear
+	 * registers in between hold no state to adopt.
+	 */
+	for (i = 0; i < ARRAY_SIZE(kts1622_reg_ranges); i++) {
+		u8 first = kts1622_reg_ranges[i].first;
+		u8 len = kts1622_reg_ranges[i].last - first + 1;
+
+		ret = kts1622_reg_read_block(chip, first, len,
+					     &chip->reg_cache[first]);
+		if (ret < 0)
+			break;
+	}
+
+	mutex_unlock(&chip->i2c_lock);
+	return ret;
+}
+
+static int device_kts1622_init(struct kts1622_chip *chip)
+{
+	int ret = 0;
+
+	if (chip->warm_attach)
+		return device_kts1622_adopt(chip);
+
+	mutex_lock(&chip->i2c_lock);
+
+	/* Reset */
+	ret = kts1622_reset(chip);
+	if (ret < 0)
+		goto error;
+
+	/* Default: Input mode (push-pull when output) */
+	ret = kts1622_reg_write(chip, KTS1622_OUTPUT_PORT_CONFIG, 0x03);
+	if (ret < 0)
+		goto error;
+
+	ret = kts1622_reg_write(chip, KTS1622_INDIVIDUAL_PIN_OUTPUT_0, 0xFF);
+	if (ret < 0)
+		goto error;
+
+	ret = kts1622_reg_write(chip, KTS1622_INDIVIDUAL_PIN_OUTPUT_1, 0xFF);
+
+error:
+	mutex_unlock(&chip->i2c_lock);
+	return ret;
+}
+
+/* Initial line configuration from DT, as raw register bytes per port */
+static const struct {
+	const char *name;
+	u8 reg_addr;
+	u8 bytes_per_port;
+	bool invert;
+	u32 feat;	/* Chip-info feature the registers depend on */
+} kts1622_init_props[] = {
+	{ "kinetic_technologies,init-output", KTS1622_OUTPUT_0, 1 },
+	{ "kinetic_technologies,init-direction", KTS1622_CONFIG_0, 1 },
+	{ "kinetic_technologies,init-polarity", KTS1622_POLARITY_INVERSION_0, 1 },
+	{ "kinetic_technologies,init-pull-enable", KTS1622_PULLUP_DOWN_ENABLE_0, 1 },
+	{ "kinetic_technologies,init-pull-select", KTS1622_PULLUP_DOWN_SELECTION_0, 1 },
+	{ "kinetic_technologies,init-open-drain", KTS1622_INDIVIDUAL_PIN_OUTPUT_0, 1, true },
+	{ "kinetic_technologies,init-drive-strength", KTS1622_DRIVE_STRENGTH_0A, 2 },
+	{ "kinetic_technologies,init-input-latch", KTS1622_INPUT_LATCH_0, 1, false,
+	  KTS1622_FEAT_INPUT_LATCH },
+};
+
+/*
+ * Apply the initial line configuration from DT. All properties are merged
+ * into one register image first, so the whole setup costs at most one block
+ * write per register run.
+ */
+static int kts1622_apply_init_config(struct kts1622_chip *chip)
+{
+	struct device *dev = &chip->client->dev;
+	u8 regs[KTS1622_NUM_REGS];
+	u8 buf[NUM_PINS];
+	u32 ma[NUM_PINS];
+	bool found = false;
+	int ret;
+	int i;
+	int j;
+
+	memcpy(regs, chip->reg_cache, KTS1622_NUM_REGS);
+
+	for (i = 0; i < ARRAY_SIZE(kts1622_init_props); i++) {
+		u8 len = kts1622_init_props[i].bytes_per_port * chip->nports;
+
+		if (!device_property_present(dev, kts1622_init_props[i].name))
+			continue;
+
+		if (kts1622_init_props[i].feat &&
+		    !(chip->info->flags & kts1622_init_props[i].feat)) {
+			dev_warn(dev, "%s not supported by %s, ignored\n",
+				 kts1622_init_props[i].name, chip->info->name);
+			continue;
+		}
+
+		ret = device_property_read_u8_array(dev, kts1622_init_props[i].name,
+						    buf, len);
+		if (ret) {
+			dev_err(dev, "%s must have %u bytes\n",
+				kts1622_init_props[i].name, len);
+			return ret;
+		}
+
+		for (j = 0; j < len; j++)
+			regs[kts1622_init_props[i].reg_addr + j] =
+				kts1622_init_props[i].invert ? ~buf[j] : buf[j];
+		found = true;
+	}
+
+	/* Per-line drive strengths in mA, merged over init-drive-strength */
+	if (device_property_present(dev, "kinetic_technologies,drive-strength")) {
+		u8 len = chip->nports * NUM_PINS_PER_PORT;
+
+		ret = device_property_read_u32_array(dev,
+				"kinetic_technologies,drive-strength", ma, len);
+		if (ret) {
+			dev_err(dev, "kinetic_technologies,drive-strength must have %u entries\n",
+				len);
+			return ret;
+		}
+
+		for (j = 0; j < len; j++) {
+			u8 reg_addr = kts1622_drive_strength_reg(j);
+			int shift = kts1622_drive_strength_shift(j);
+			int level = kts1622_drive_strength_level(ma[j]);
+
+			if (level < 0) {
+				dev_err(dev, "line %d: drive strength must be 1 to %d mA\n",
+					j, DRIVE_STRENGTH_FULL_MA);
+				return -EINVAL;
+			}
+
+			regs[reg_addr] &= ~(DRIVE_STRENGTH_MASK << shift);
+			regs[reg_addr] |= level << shift;
+		}
+		found = true;
+	}
+
+	if (!found)
+		return 0;
+
+	mutex_lock(&chip->i2c_lock);
+	ret = kts1622_cache_apply(chip, regs);
+	mutex_unlock(&chip->i2c_lock);
+
+	return ret;
+}
+
+/* Per-line input latch, as a mask of lines (bit 0 = line 0) */
+static ssize_t input_latch_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct kts1622_chip *chip = dev_get_drvdata(dev);
+	u32 mask = 0;
+	int port;
+
+	mutex_lock(&chip->i2c_lock);
+	for (port = 0; port < chip->nports; port++)
+		mask |= chip->reg_cache[KTS1622_INPUT_LATCH_0 + port] <<
+			(port * NUM_PINS_PER_PORT);
+	mutex_unlock(&chip->i2c_lock);
+
+	return sprintf(buf, "0x%0*x\n", chip->nports * 2, mask);
+}
+
+static ssize_t input_latch_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct kts1622_chip *chip = dev_get_drvdata(dev);
+	u8 regs[NUM_PORTS];
+	u32 mask;
+	int port;
+	int ret;
+
+	if (!(chip->info->flags & KTS1622_FEAT_INPUT_LATCH))
+		return -EOPNOTSUPP;
+	if (chip->keypad.enabled)
+		return -EBUSY;
+
+	ret = kstrtou32(buf, 0, &mask);
+	if (ret)
+		return ret;
+	if (mask >> (chip->nports * NUM_PINS_PER_PORT))
+		return -EINVAL;
+
+	for (port = 0; port < chip->nports; port++)
+		regs[port] = mask >> (port * NUM_PINS_PER_PORT);
+
+	mutex_lock(&chip->i2c_lock);
+	ret = kts1622_reg_write_block(chip, KTS1622_INPUT_LATCH_0, chip->nports,
+				      regs);
+	for (port = 0; port < chip->nports; port++)
+		chip->latch_pending[port] &= regs[port];
+	mutex_unlock(&chip->i2c_lock);
+
+	return ret < 0 ? ret : count;
+}
+static DEVICE_ATTR_RW(input_latch);
+
+/*
+ * Change the worker settings and apply them to the worker and the PWM engine
+ * thread. sched < 0 or cpus == NULL keeps the current value. The engine lock
+ * is taken first, as when the engine thread is started.
+ */
+static void kts1622_worker_set(struct kts1622_chip *chip, int sched,
+			       const struct cpumask *cpus)
+{
+	struct kts1622_worker *w = &chip->worker;
+	struct kts1622_pwm *kpwm = &chip->pwm;
+
+	if (kpwm->registered)
+		mutex_lock(&kpwm->lock);
+	mutex_lock(&w->lock);
+
+	if (sched >= 0)
+		w->sched = sched;
+	if (cpus)
+		cpumask_copy(&w->cpus, cpus);
+
+	kts1622_worker_apply(chip, w->worker->task);
+	if (kpwm->registered && kpwm->thread)
+		kts1622_worker_apply(chip, kpwm->thread);
+
+	mutex_unlock(&w->lock);
+	if (kpwm->registered)
+		mutex_unlock(&kpwm->lock);
+}
+
+static ssize_t worker_sched_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct kts1622_chip *chip = dev_get_drvdata(dev);
+
+	if (!chip->worker.worker)
+		return sprintf(buf, "none\n");
+
+	return sprintf(buf, "%s\n", kts1622_sched_names[chip->worker.sched]);
+}
+
+static ssize_t worker_sched_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct kts1622_chip *chip = dev_get_drvdata(dev);
+	int ret;
+
+	if (!chip->worker.worker)
+		return -ENODEV;
+
+	ret = sysfs_match_string(kts1622_sched_names, buf);
+	if (ret < 0)
+		return ret;
+
+	kts1622_worker_set(chip, ret, NULL);
+
+	return count;
+}
+static DEVICE_ATTR_RW(worker_sched);
+
+static ssize_t worker_cpus_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct kts1622_chip *chip = dev_get_drvdata(dev);
+	ssize_t len;
+
+	if (!chip->worker.worker)
+		return sprintf(buf, "none\n");
+
+	mutex_lock(&chip->worker.lock);
+	len = sprintf(buf, "%*pbl\n", cpumask_pr_args(&chip->worker.cpus));
+	mutex_unlock(&chip->worker.lock);
+
+	return len;
+}
+
+static ssize_t worker_cpus_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct kts1622_chip *chip = dev_get_drvdata(dev);
+	cpumask_var_t cpus;
+	int ret;
+
+	if (!chip->worker.worker)
+		return -ENODEV;
+
+	if (!alloc_cpumask_var(&cpus, GFP_KERNEL))
+		return -ENOMEM;
+
+	ret = cpulist_parse(buf, cpus);
+	if (ret == 0 && !cpumask_intersects(cpus, cpu_online_mask))
+		ret = -EINVAL;
+	if (ret == 0)
+		kts1622_worker_set(chip, -1, cpus);
+
+	free_cpumask_var(cpus);
+
+	return ret < 0 ? ret : count;
+}
+static DEVICE_ATTR_RW(worker_cpus);
+
+/* Keep the rule inputs armed on both edges, irq_lock and i2c_lock held */
+static void kts1622_reflex_arm(struct kts1622_chip *chip)
+{
+	struct kts1622_reflex *rx = &chip->reflex;
+	unsigned long active = rx->active;
+	unsigned long lines = 0;
+	int line;
+	int port;
+	int i;
+
+	for_each_set_bit(i, &active, KTS1622_REFLEX_MAX)
+		lines |= rx->rule[i].in_mask;
+
+	memset(rx->pins, 0, sizeof(rx->pins));
+	memset(rx->edge, 0, sizeof(rx->edge));
+	for_each_set_bit(line, &lines, NUM_PINS) {
+		rx->pins[line / NUM_PINS_PER_PORT] |= BIT(line % NUM_PINS_PER_PORT);
+		rx->edge[line / 4] |= 0x03 << ((line % 4) * 2);
+	}
+
+	for (port = 0; port < chip->nports; port++) {
+		kts1622_irq_edge_write(chip, port * 2);
+		kts1622_irq_edge_write(chip, port * 2 + 1);
+		kts1622_irq_mask_write(chip, port);
+	}
+}
+
+static ssize_t reflex_show(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	struct kts1622_chip *chip = dev_get_drvdata(dev);
+	struct kts1622_reflex *rx = &chip->reflex;
+	unsigned long active;
+	ssize_t len = 0;
+	int i;
+
+	mutex_lock(&chip->i2c_lock);
+	active = rx->active;
+	for_each_set_bit(i, &active, KTS1622_REFLEX_MAX) {
+		struct kts1622_reflex_rule *r = &rx->rule[i];
+
+		len += sprintf(buf + len, "%d %04x %04x %04x %04x %04x\n", i,
+			       r->in_mask, r->in_match, r->out_mask, r->out_val,
+			       r->out_else);
+	}
+	mutex_unlock(&chip->i2c_lock);
+
+	return len;
+}
+
+/*
+ * "<rule> <in_mask> <in_match> <out_mask> <out_val> <out_else>" (hex) sets a
+ * rule, "<rule> off" removes it.
+ */
+static ssize_t reflex_store(struct device *dev, struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct kts1622_chip *chip = dev_get_drvdata(dev);
+	struct kts1622_reflex *rx = &chip->reflex;
+	u16 lines = GENMASK(chip->gpio_chip.ngpio - 1, 0);
+	struct kts1622_reflex_rule r = { };
+	u8 input[NUM_PORTS];
+	unsigned int idx;
+	char op[4];
+	bool off;
+	u8 was;
+	u8 now;
+	int ret = 0;
+
+	if (!chip->gpio_chip.irq.domain)
+		return -ENODEV;
+
+	if (sscanf(buf, "%u %hx %hx %hx %hx %hx", &idx, &r.in_mask, &r.in_match,
+		   &r.out_mask, &r.out_val, &r.out_else) == 6)
+		off = false;
+	else if (sscanf(buf, "%u %3s", &idx, op) == 2 && !strcmp(op, "off"))
+		off = true;
+	else
+		return -EINVAL;
+
+	if (idx >= KTS1622_REFLEX_MAX)
+		return -EINVAL;
+	if (!off && (((r.in_mask | r.out_mask) & ~lines) ||
+		     (r.in_match & ~r.in_mask) || !r.in_mask || !r.out_mask))
+		return -EINVAL;
+
+	/*
+	 * Active rules hold one runtime PM reference: a suspended chip gates
+	 * its interrupt, and the rules would silently stop acting.
+	 */
+	if (!off) {
+		ret = kts1622_pm_get(chip);
+		if (ret < 0)
+			return ret;
+	}
+
+	mutex_lock(&chip->irq_lock);
+	mutex_lock(&chip->i2c_lock);
+	was = rx->active;
+	if (off) {
+		rx->active &= ~BIT(idx);
+	} else {
+		rx->rule[idx] = r;
+		rx->active |= BIT(idx);
+	}
+	now = rx->active;
+	kts1622_reflex_arm(chip);
+
+	/* The outputs follow inputs that are already asserted, not only edges. */
+	if (!off) {
+		ret = kts1622_reg_read_block(chip, KTS1622_INPUT_0, chip->nports,
+					     input);
+		if (ret == 0)
+			__kts1622_reflex_eval(chip, input, ktime_get_ns());
+	}
+	mutex_unlock(&chip->i2c_lock);
+	mutex_unlock(&chip->irq_lock);
+
+	/* Keep a single reference, from the first rule to the last one */
+	if (was && (!off || !now))
+		kts1622_pm_put(chip);
+
+	return ret < 0 ? ret : count;
+}
+static DEVICE_ATTR_RW(reflex);
+
+/*
+ * Configuration image: the register file indexed by register address,
+ * KTS1622_NUM_REGS bytes. A write applies all writable registers at once with
+ * one block write per register run, in kts1622_reg_ranges order so outputs
+ * take their level before lines turn into outputs. Volatile and reserved
+ * bytes are ignored on write and read back as 0.
+ */
+static bool kts1622_reg_in_image(u8 reg_addr)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kts1622_reg_ranges); i++)
+		if (reg_addr >= kts1622_reg_ranges[i].first &&
+		    reg_addr <= kts1622_reg_ranges[i].last)
+			return true;
+
+	return false;
+}
+
+static ssize_t config_read(struct file *filp, struct kobject *kobj,
+			   struct bin_attribute *attr, char *buf, loff_t off,
+			   size_t count)
+{
+	struct kts1622_chip *chip = dev_get_drvdata(kobj_to_dev(kobj));
+	u8 image[KTS1622_NUM_REGS];
+	int i;
+
+	mutex_lock(&chip->i2c_lock);
+	for (i = 0; i < KTS1622_NUM_REGS; i++)
+		image[i] = kts1622_reg_in_image(i) ? chip->reg_cache[i] : 0;
+	mutex_unlock(&chip->i2c_lock);
+
+	return memory_read_from_buffer(buf, count, &off, image, sizeof(image));
+}
+
+static ssize_t config_write(struct file *filp, struct kobject *kobj,
+			    struct bin_attribute *attr, char *buf, loff_t off,
+			    size_t count)
+{
+	struct kts1622_chip *chip = dev_get_drvdata(kobj_to_dev(kobj));
+	const u8 *image = buf;
+	u8 regs[KTS1622_NUM_REGS];
+	int port;
+	int reg;
+	int ret;
+
+	if (off != 0 || count != KTS1622_NUM_REGS)
+		return -EINVAL;
+	if (chip->keypad.enabled)
+		return -EBUSY;
+
+	mutex_lock(&chip->irq_lock);
+	mutex_lock(&chip->i2c_lock);
+
+	for (reg = 0; reg < KTS1622_NUM_REGS; reg++)
+		regs[reg] = kts1622_reg_in_image(reg) ? image[reg] :
+			    chip->reg_cache[reg];
+
+	for (port = 0; port < chip->nports; port++) {
+		u8 pol = KTS1622_POLARITY_INVERSION_0 + port;
+
+		/*
+		 * The interrupt settings become the consumers' settings, the
+		 * lines armed by the driver stay armed.
+		 */
+		chip->irq_mask[port] = regs[KTS1622_INTERRUPT_MASK_0 + port];
+		for (reg = port * 2; reg < port * 2 + 2; reg++)
+			chip->irq_edge[reg] = kts1622_irq_edge_swap(
+					regs[pol], reg,
+					regs[KTS1622_INTERRUPT_EDGE_0A + reg]);
+
+		regs[KTS1622_INTERRUPT_MASK_0 + port] = kts1622_irq_mask_hw(chip, port);
+		for (reg = port * 2; reg < port * 2 + 2; reg++)
+			regs[KTS1622_INTERRUPT_EDGE_0A + reg] |=
+				kts1622_irq_edge_armed(chip, reg);
+
+		chip->latch_pending[port] &= regs[KTS1622_INPUT_LATCH_0 + port];
+	}
+
+	ret = kts1622_cache_apply(chip, regs);
+
+	mutex_unlock(&chip->i2c_lock);
+	mutex_unlock(&chip->irq_lock);
+
+	return ret < 0 ? ret : count;
+}
+static BIN_ATTR_RW(config, KTS1622_NUM_REGS);
+
+static struct attribute *kts1622_attrs[] = {
+	&dev_attr_input_latch.attr,
+	&dev_attr_worker_sched.attr,
+	&dev_attr_worker_cpus.attr,
+	&dev_attr_reflex.attr,
+	NULL,
+};
+
+static struct bin_attribute *kts1622_bin_attrs[] = {
+	&bin_attr_config,
+	NULL,
+};
+
+static const struct attribute_group kts1622_group = {
+	.attrs = kts1622_attrs,
+	.bin_attrs = kts1622_bin_attrs,
+};
+__ATTRIBUTE_GROUPS(kts1622);
+
+/*
+ * Wait-for-pattern: KTS1622_IOC_WAIT_PATTERN blocks until the inputs match a
+ * value under a mask. Every interrupt compares its input snapshot with the
+ * waiters and completes only those that match. The compared lines interrupt
+ * on both edges while waited on. Chips without an interrupt are polled.
+ */
+static void kts1622_pattern_arm(struct kts1622_chip *chip, u16 mask, bool arm)
+{
+	struct kts1622_pattern *pat = chip->pattern;
+	unsigned long lines = mask;
+	bool changed = false;
+	int line;
+	int port;
+
+	mutex_lock(&chip->irq_lock);
+	mutex_lock(&chip->i2c_lock);
+
+	for_each_set_bit(line, &lines, NUM_PINS) {
+		if (arm ? pat->users[line]++ : --pat->users[line])
+			continue;
+		chip->watch_pins[line / NUM_PINS_PER_PORT] ^=
+			BIT(line % NUM_PINS_PER_PORT);
+		chip->watch_edge[line / 4] ^= 0x03 << ((line % 4) * 2);
+		changed = true;
+	}
+
+	for (port = 0; changed && port < chip->nports; port++) {
+		kts1622_irq_edge_write(chip, port * 2);
+		kts1622_irq_edge_write(chip, port * 2 + 1);
+		kts1622_irq_mask_write(chip, port);
+	}
+
+	mutex_unlock(&chip->i2c_lock);
+	mutex_unlock(&chip->irq_lock);
+}
+
+/* Take a snapshot outside of the interrupt handler */
+static int kts1622_pattern_poll(struct kts1622_chip *chip)
+{
+	u8 input[NUM_PORTS];
+	int ret;
+
+	mutex_lock(&chip->i2c_lock);
+	ret = kts1622_reg_read_block(chip, KTS1622_INPUT_0, chip->nports, input);
+	mutex_unlock(&chip->i2c_lock);
+	if (ret < 0)
+		return ret;
+
+	kts1622_pattern_update(chip, input, ktime_get_ns());
+
+	return 0;
+}
+
+static int kts1622_pattern_wait(struct kts1622_chip *chip,
+				struct kts1622_wait_pattern *req)
+{
+	struct kts1622_pattern *pat = chip->pattern;
+	struct kts1622_pattern_waiter w = {
+		.mask = req->mask,
+		.value = req->value,
+	};
+	bool irq = chip->gpio_chip.irq.domain != NULL;
+	long left = req->timeout_ms < 0 ? MAX_SCHEDULE_TIMEOUT :
+		    msecs_to_jiffies(req->timeout_ms);
+	long slice;
+	long done;
+	int ret;
+
+	INIT_LIST_HEAD(&w.node);
+	init_completion(&w.done);
+
+	/* A suspended chip gates its interrupt, the wait could only time out. */
+	ret = kts1622_pm_get(chip);
+	if (ret < 0)
+		return ret;
+
+	spin_lock(&pat->lock);
+	if (pat->dead) {
+		spin_unlock(&pat->lock);
+		kts1622_pm_put(chip);
+		return -ENODEV;
+	}
+	list_add_tail(&w.node, &pat->waiters);
+	spin_unlock(&pat->lock);
+
+	/* Armed before the first snapshot, so no edge goes unseen. */
+	if (irq)
+		kts1622_pattern_arm(chip, req->mask, true);
+
+	for (;;) {
+		ret = kts1622_pattern_poll(chip);
+		if (ret < 0)
+			break;
+
+		slice = irq ? left :
+			min_t(long, left, msecs_to_jiffies(KTS1622_PATTERN_POLL_MS));
+		done = wait_for_completion_interruptible_timeout(&w.done, slice);
+		if (done) {
+			/*
+			 * Not -ERESTARTSYS: a restart would wait for the full
+			 * timeout again.
+			 */
+			ret = done < 0 ? -EINTR : 0;
+			break;
+		}
+
+		if (left != MAX_SCHEDULE_TIMEOUT) {
+			left -= slice;
+			if (left <= 0) {
+				ret = -ETIMEDOUT;
+				break;
+			}
+		}
+	}
+
+	/* Off the list means completed, possibly while we gave up. */
+	spin_lock(&pat->lock);
+	if (list_empty(&w.node))
+		ret = w.err;
+	else
+		list_del(&w.node);
+	spin_unlock(&pat->lock);
+
+	if (irq)
+		kts1622_pattern_arm(chip, req->mask, false);
+
+	kts1622_pm_put(chip);
+
+	if (ret == 0) {
+		req->input = w.input;
+		req->timestamp_ns = w.ts;
+	}
+
+	return ret;
+}
+
+static int kts1622_pattern_open(struct inode *inode, struct file *file)
+{
+	struct kts1622_pattern *pat = container_of(file->private_data,
+						   struct kts1622_pattern, misc);
+
+	kref_get(&pat->ref);
+	file->private_data = pat;
+
+	return nonseekable_open(inode, file);
+}
+
+static void kts1622_pattern_free(struct kref *ref)
+{
+	struct kts1622_pattern *pat = container_of(ref, struct kts1622_pattern,
+						   ref);
+
+	kfree(pat->misc.name);
+	kfree(pat);
+}
+
+static int kts1622_pattern_release(struct inode *inode, struct file *file)
+{
+	struct kts1622_pattern *pat = file->private_data;
+
+	kref_put(&pat->ref, kts1622_pattern_free);
+
+	return 0;
+}
+
+static long kts1622_pattern_ioctl(struct file *file, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct kts1622_pattern *pat = file->private_data;
+	struct kts1622_wait_pattern req;
+	long ret;
+
+	if (cmd != KTS1622_IOC_WAIT_PATTERN)
+		return -ENOTTY;
+
+	if (copy_from_user(&req, (void __user *)arg, sizeof(req)))
+		return -EFAULT;
+	if ((req.value & ~req.mask) || memchr_inv(req.padding, 0, sizeof(req.padding)))
+		return -EINVAL;
+
+	down_read(&pat->rwsem);
+	if (pat->chip && !(req.mask & ~GENMASK(pat->chip->gpio_chip.ngpio - 1, 0)))
+		ret = kts1622_pattern_wait(pat->chip, &req);
+	else
+		ret = pat->chip ? -EINVAL : -ENODEV;
+	up_read(&pat->rwsem);
+
+	if (ret == 0 && copy_to_user((void __user *)arg, &req, sizeof(req)))
+		ret = -EFAULT;
+
+	return ret;
+}
+
+static const struct file_operations kts1622_pattern_fops = {
+	.owner		= THIS_MODULE,
+	.open		= kts1622_pattern_open,
+	.release	= kts1622_pattern_release,
+	.unlocked_ioctl	= kts1622_pattern_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
+	.llseek		= no_llseek,
+};
+
+static void kts1622_pattern_put(void *data)
+{
+	struct kts1622_pattern *pat = data;
+
+	kref_put(&pat->ref, kts1622_pattern_free);
+}
+
+/*
+ * The chip's reference is dropped by devm after the interrupt is freed, the
+ * handler uses the waiter list until then.
+ */
+static int kts1622_pattern_setup(struct kts1622_chip *chip)
+{
+	struct device *dev = &chip->client->dev;
+	struct kts1622_pattern *pat;
+
+	pat = kzalloc(sizeof(*pat), GFP_KERNEL);
+	if (!pat)
+		return -ENOMEM;
+
+	kref_init(&pat->ref);
+	init_rwsem(&pat->rwsem);
+	spin_lock_init(&pat->lock);
+	INIT_LIST_HEAD(&pat->waiters);
+	pat->chip = chip;
+	pat->misc.minor = MISC_DYNAMIC_MINOR;
+	pat->misc.fops = &kts1622_pattern_fops;
+	pat->misc.parent = dev;
+	pat->misc.name = kasprintf(GFP_KERNEL, "kts1622-%s", dev_name(dev));
+	if (!pat->misc.name) {
+		kfree(pat);
+		return -ENOMEM;
+	}
+
+	chip->pattern = pat;
+
+	return devm_add_action_or_reset(dev, kts1622_pattern_put, pat);
+}
+
+static int kts1622_pattern_register(struct kts1622_chip *chip)
+{
+	struct kts1622_pattern *pat = chip->pattern;
+	int ret;
+
+	ret = misc_register(&pat->misc);
+	if (ret) {
+		dev_err(&chip->client->dev, "failed to register %s\n",
+			pat->misc.name);
+		return ret;
+	}
+	pat->registered = true;
+
+	return 0;
+}
+
+/* Fail the waiters, then wait for the ioctls still using the chip */
+static void kts1622_pattern_teardown(struct kts1622_chip *chip)
+{
+	struct kts1622_pattern *pat = chip->pattern;
+	struct kts1622_pattern_waiter *w, *tmp;
+
+	if (!pat)
+		return;
+
+	if (pat->registered)
+		misc_deregister(&pat->misc);
+	pat->registered = false;
+
+	spin_lock(&pat->lock);
+	pat->dead = true;
+	list_for_each_entry_safe(w, tmp, &pat->waiters, node) {
+		w->err = -ENODEV;
+		list_del_init(&w->node);
+		complete(&w->done);
+	}
+	spin_unlock(&pat->lock);
+
+	down_write(&pat->rwsem);
+	pat->chip = NULL;
+	up_write(&pat->rwsem);
+}
+
+static struct dentry *kts1622_debugfs_root;
+
+static int kts1622_trace_show(struct seq_file *s, void *unused)
+{
+	struct kts1622_trace_entry *e;
+	unsigned int i;
+
+	spin_lock_irq(&kts1622_trace.lock);
+	seq_printf(s, "# dropped %llu\n", kts1622_trace.dropped);
+	seq_puts(s, "# ts_ns dur_ns class path addr dir cont reg len data ret\n");
+	for (i = 0; i < kts1622_trace.count; i++) {
+		e = &kts1622_trace.ring[(kts1622_trace.head + KTS1622_TRACE_ENTRIES -
+					 kts1622_trace.count + i) % KTS1622_TRACE_ENTRIES];
+
+		seq_printf(s, "%llu %u %s %s 0x%02x %c %d 0x%02x %u ",
+			   e->ts, e->duration, kts1622_trace_class_names[e->class],
+			   kts1622_xfer_names[e->path], e->addr,
+			   e->flags & KTS1622_TRACE_READ ? 'R' : 'W',
+			   !!(e->flags & KTS1622_TRACE_CONT), e->reg, e->len);
+		if (e->ret < 0 || !e->len)
+			seq_puts(s, "-");
+		else
+			seq_printf(s, "%*phN", min_t(int, e->len, KTS1622_TRACE_DATA),
+				   e->data);
+		seq_printf(s, " %d\n", e->ret);
+	}
+	spin_unlock_irq(&kts1622_trace.lock);
+
+	return 0;
+}
+
+static int kts1622_trace_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, kts1622_trace_show, inode->i_private);
+}
+
+/* Any write empties the ring */
+static ssize_t kts1622_trace_write(struct file *file, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	spin_lock_irq(&kts1622_trace.lock);
+	kts1622_trace.head = 0;
+	kts1622_trace.count = 0;
+	kts1622_trace.dropped = 0;
+	spin_unlock_irq(&kts1622_trace.lock);
+
+	return count;
+}
+
+static const struct file_operations kts1622_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = kts1622_trace_open,
+	.read = seq_read,
+	.write = kts1622_trace_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int kts1622_trace_enable_get(void *data, u64 *val)
+{
+	*val = READ_ONCE(kts1622_trace.enabled);
+	return 0;
+}
+
+static int kts1622_trace_enable_set(void *data, u64 val)
+{
+	struct kts1622_trace_entry *ring = NULL;
+
+	if (val && !READ_ONCE(kts1622_trace.ring)) {
+		ring = vzalloc(array_size(KTS1622_TRACE_ENTRIES, sizeof(*ring)));
+		if (!ring)
+			return -ENOMEM;
+	}
+
+	spin_lock_irq(&kts1622_trace.lock);
+	if (ring && !kts1622_trace.ring) {
+		kts1622_trace.ring = ring;
+		ring = NULL;
+	}
+	WRITE_ONCE(kts1622_trace.enabled, !!val);
+	spin_unlock_irq(&kts1622_trace.lock);
+
+	vfree(ring);
+
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(kts1622_trace_enable_fops, kts1622_trace_enable_get,
+			 kts1622_trace_enable_set, "%llu\n");
+
+static int kts1622_xfer_show(struct seq_file *s, void *unused)
+{
+	struct kts1622_chip *chip = s->private;
+	struct kts1622_xfer *xfer = &chip->xfer;
+	int path;
+
+	seq_printf(s, "adapter: %s\n", chip->client->adapter->name);
+	seq_printf(s, "single: %s\n", kts1622_xfer_names[xfer->single]);
+	seq_printf(s, "pair: %s\n", kts1622_xfer_names[xfer->pair]);
+	seq_printf(s, "bulk: %s\n", kts1622_xfer_names[xfer->bulk]);
+
+	seq_puts(s, "supported:");
+	for (path = 0; path < KTS1622_XFER_NUM; path++)
+		if (xfer->supported & BIT(path))
+			seq_printf(s, " %s", kts1622_xfer_names[path]);
+	seq_puts(s, "\n");
+
+	seq_puts(s, "round trip (ns, 1 byte / 2 bytes):\n");
+	for (path = 0; path < KTS1622_XFER_NUM; path++)
+		if (xfer->supported & BIT(path))
+			seq_printf(s, " %s: %llu / %llu\n", kts1622_xfer_names[path],
+				   xfer->single_ns[path], xfer->pair_ns[path]);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(kts1622_xfer);
+
+static int kts1622_irq_throttle_show(struct seq_file *s, void *unused)
+{
+	struct kts1622_chip *chip = s->private;
+	struct kts1622_irq_rl *rl = &chip->irq_rl;
+	unsigned int line;
+
+	seq_puts(s, "line dropped state\n");
+	spin_lock(&rl->lock);
+	for (line = 0; line < chip->nports * NUM_PINS_PER_PORT; line++) {
+		u8 bit = BIT(line % NUM_PINS_PER_PORT);
+		unsigned int port = line / NUM_PINS_PER_PORT;
+
+		if (!rl->dropped[line])
+			continue;
+		seq_printf(s, "%u %llu %s\n", line, rl->dropped[line],
+			   rl->masked[port] & bit ? "masked" :
+			   rl->throttled[port] & bit ? "throttled" : "-");
+	}
+	spin_unlock(&rl->lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(kts1622_irq_throttle);
+
+static int kts1622_reflex_stats_show(struct seq_file *s, void *unused)
+{
+	struct kts1622_chip *chip = s->private;
+	struct kts1622_reflex *rx = &chip->reflex;
+	unsigned long active;
+	int i;
+
+	seq_puts(s, "rule evals reactions last_ns max_ns avg_ns\n");
+	mutex_lock(&chip->i2c_lock);
+	active = rx->active;
+	for_each_set_bit(i, &active, KTS1622_REFLEX_MAX) {
+		struct kts1622_reflex_rule *r = &rx->rule[i];
+
+		seq_printf(s, "%d %llu %llu %llu %llu %llu\n", i, r->evals,
+			   r->reactions, r->last_ns, r->max_ns,
+			   r->reactions ? div64_u64(r->total_ns, r->reactions) : 0);
+	}
+	mutex_unlock(&chip->i2c_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(kts1622_reflex_stats);
+
+static void kts1622_debugfs_init(struct kts1622_chip *chip)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir(dev_name(&chip->client->dev), kts1622_debugfs_root);
+	chip->debugfs = dir;
+
+	debugfs_create_u64("resume_latency_us", 0444, dir, &chip->pm.resume_us);
+	debugfs_create_u64("resume_latency_max_us", 0444, dir,
+			   &chip->pm.resume_max_us);
+	debugfs_create_u32("resume_count", 0444, dir, &chip->pm.resume_count);
+	debugfs_create_file("xfer", 0444, dir, chip, &kts1622_xfer_fops);
+
+	debugfs_create_u32("xfer_retries", 0644, dir, &chip->err.retries);
+	debugfs_create_u32("xfer_budget_us", 0644, dir, &chip->err.budget_us);
+	debugfs_create_u32("recover_after", 0644, dir, &chip->err.recover_after);
+	debugfs_create_atomic_t("errors", 0444, dir, &chip->err.errors);
+	debugfs_create_atomic_t("retries", 0444, dir, &chip->err.retried);
+	debugfs_create_atomic_t("budget_exceeded", 0444, dir,
+				&chip->err.budget_exceeded);
+	debugfs_create_atomic_t("recoveries", 0444, dir, &chip->err.recoveries);
+	debugfs_create_atomic_t("resyncs", 0444, dir, &chip->err.resyncs);
+
+	debugfs_create_u32("irq_rate_burst", 0644, dir, &chip->irq_rl.burst);
+	debugfs_create_u32("irq_rate_interval_ms", 0644, dir,
+			   &chip->irq_rl.interval_ms);
+	debugfs_create_bool("irq_rate_mask", 0644, dir, &chip->irq_rl.mask);
+	debugfs_create_file("irq_throttle", 0444, dir, chip,
+			    &kts1622_irq_throttle_fops);
+	debugfs_create_file("reflex", 0444, dir, chip, &kts1622_reflex_stats_fops);
+}
+
+static void kts1622_debugfs_remove(struct kts1622_chip *chip)
+{
+	debugfs_remove_recursive(chip->debugfs);
+	chip->debugfs = NULL;
 }
 
-static int kts1622_gpio_set_config(struct gpio_chip *gc, unsigned int offset,
-				   unsigned long config)
+/*
+ * Aggregator: a wide gpio_chip spanning this chip and the chips listed in
+ * kinetic_technologies,aggregate, all on the same adapter. Multi-line set and
+ * get go out as one i2c_transfer with one message (pair) per affected chip,
+ * which keeps the skew between chips to the gap between two messages.
+ */
+static inline struct kts1622_chip *kts1622_aggregate_map(struct kts1622_aggregate *agg,
+							 unsigned int *offset)
 {
-	struct kts1622_chip *chip = gpiochip_get_data(gc);
+	struct kts1622_chip *chip = agg->chips[*offset / agg->chip_ngpio];
 
-	switch (pinconf_to_config_param(config)) {
-	case PIN_CONFIG_BIAS_PULL_UP:
-	case PIN_CONFIG_BIAS_PULL_DOWN:
-		return kts1622_gpio_set_pull_up_down(chip, offset, config);
+	*offset %= agg->chip_ngpio;
+	return chip;
+}
 
-	case PIN_CONFIG_DRIVE_OPEN_DRAIN:
-	case PIN_CONFIG_DRIVE_PUSH_PULL:
-		return kts1622_gpio_set_open_drain(chip, offset, config);
+/*
+ * An aggregate line claims the member's line, so the two cannot be requested
+ * at the same time, and the member's request/free hooks (runtime PM) run as
+ * for a direct consumer.
+ */
+static int kts1622_aggregate_request(struct gpio_chip *gc, unsigned offset)
+{
+	struct kts1622_aggregate *agg = gpiochip_get_data(gc);
+	unsigned int line = offset;
+	struct kts1622_chip *chip = kts1622_aggregate_map(agg, &line);
+	struct gpio_desc *desc;
 
-	default:
-		return -ENOTSUPP;
-	}
+	desc = gpiochip_request_own_desc(&chip->gpio_chip, line, gc->label,
+					 GPIO_LOOKUP_FLAGS_DEFAULT, GPIOD_ASIS);
+	if (IS_ERR(desc))
+		return PTR_ERR(desc);
+
+	agg->descs[offset] = desc;
+	return 0;
 }
 
-static void kts1622_irq_mask(struct irq_data *d)
+static void kts1622_aggregate_free(struct gpio_chip *gc, unsigned offset)
 {
-	struct gpio_chip *gc = irq_data_get_irq_chip_data(d);
-	struct kts1622_chip *chip = gpiochip_get_data(gc);
-	int port = d->hwirq / 8;
-	int pin = d->hwirq % 8;
+	struct kts1622_aggregate *agg = gpiochip_get_data(gc);
 
-	chip->irq_mask[port] |= 1 << pin;
+	gpiochip_free_own_desc(agg->descs[offset]);
+	agg->descs[offset] = NULL;
 }
 
-static void kts1622_irq_unmask(struct irq_data *d)
+static int kts1622_aggregate_get(struct gpio_chip *gc, unsigned offset)
 {
-	struct gpio_chip *gc = irq_data_get_irq_chip_data(d);
-	struct kts1622_chip *chip = gpiochip_get_data(gc);
-	int port = d->hwirq / 8;
-	int pin = d->hwirq % 8;
+	struct kts1622_chip *chip = kts1622_aggregate_map(gpiochip_get_data(gc), &offset);
 
-	chip->irq_mask[port] &= ~(1 << pin);
+	return kts1622_gpio_get_value(&chip->gpio_chip, offset);
 }
 
-static void kts1622_irq_bus_lock(struct irq_data *d)
+static void kts1622_aggregate_set(struct gpio_chip *gc, unsigned offset, int val)
 {
-	struct gpio_chip *gc = irq_data_get_irq_chip_data(d);
-	struct kts1622_chip *chip = gpiochip_get_data(gc);
+	struct kts1622_chip *chip = kts1622_aggregate_map(gpiochip_get_data(gc), &offset);
 
-	mutex_lock(&chip->irq_lock);
+	kts1622_gpio_set_value(&chip->gpio_chip, offset, val);
 }
 
-static void kts1622_irq_bus_sync_unlock(struct irq_data *d)
+static int kts1622_aggregate_direction_input(struct gpio_chip *gc, unsigned offset)
 {
-	struct gpio_chip *gc = irq_data_get_irq_chip_data(d);
-	struct kts1622_chip *chip = gpiochip_get_data(gc);
-	int port;
-
-	/* Synchronize the register value */
-	for (port=0; port<NUM_PORTS; port++) {
-		kts1622_reg_write(chip, KTS1622_INTERRUPT_MASK_0 + port, chip->irq_mask[port]);
-		kts1622_reg_write(chip, KTS1622_INTERRUPT_EDGE_0A + port*2, chip->irq_edge[port*2]);
-		kts1622_reg_write(chip, KTS1622_INTERRUPT_EDGE_0A + port*2 + 1, chip->irq_edge[port*2 + 1]);
-	}
+	struct kts1622_chip *chip = kts1622_aggregate_map(gpiochip_get_data(gc), &offset);
 
-	mutex_unlock(&chip->irq_lock);
+	return kts1622_gpio_direction_input(&chip->gpio_chip, offset);
 }
 
-static int kts1622_irq_set_type(struct irq_data *d, unsigned int type)
+static int kts1622_aggregate_direction_output(struct gpio_chip *gc,
+					      unsigned offset, int val)
 {
-	struct gpio_chip *gc = irq_data_get_irq_chip_data(d);
-	struct kts1622_chip *chip = gpiochip_get_data(gc);
-	struct i2c_client *client = chip->client;
-	u8 val;
+	struct kts1622_chip *chip = kts1622_aggregate_map(gpiochip_get_data(gc), &offset);
 
-	switch (type) {
-	case IRQ_TYPE_EDGE_RISING:
-		val = 0x01;
-		break;
+	return kts1622_gpio_direction_output(&chip->gpio_chip, offset, val);
+}
 
-	case IRQ_TYPE_EDGE_FALLING:
-		val = 0x02;
-		break;
+static int kts1622_aggregate_get_direction(struct gpio_chip *gc, unsigned offset)
+{
+	struct kts1622_chip *chip = kts1622_aggregate_map(gpiochip_get_data(gc), &offset);
 
-	case IRQ_TYPE_EDGE_BOTH:
-		val = 0x03;
-		break;
+	return kts1622_gpio_get_direction(&chip->gpio_chip, offset);
+}
 
-	case IRQ_TYPE_LEVEL_LOW:
-	case IRQ_TYPE_LEVEL_HIGH:
-		val = 0x00;
-		break;
+static int kts1622_aggregate_set_config(struct gpio_chip *gc, unsigned offset,
+					unsigned long config)
+{
+	struct kts1622_chip *chip = kts1622_aggregate_map(gpiochip_get_data(gc), &offset);
 
-	default:
-		dev_err(&client->dev, "unsupported irq type: %u\n", type);
-		return -EINVAL;
-	}
+	return kts1622_gpio_set_config(&chip->gpio_chip, offset, config);
+}
 
-	chip->irq_edge[d->hwirq/4] &= ~(0x03 << (d->hwirq % 4));
-	chip->irq_edge[d->hwirq/4] |= val << ((d->hwirq % 4) * 2);
+/*
+ * A chip can be a member of several aggregates, so members are locked in one
+ * order for all of them: by adapter number, then by address. Every i2c_lock
+ * has its own lockdep class, so lockdep checks that order instead of being
+ * told to ignore it.
+ */
+static inline u32 kts1622_lock_rank(struct kts1622_chip *chip)
+{
+	return (chip->client->adapter->nr << 16) | chip->client->addr;
+}
 
-	return 0;
+static void kts1622_aggregate_lock(struct kts1622_aggregate *agg, unsigned long used)
+{
+	int i;
+
+	for (i = 0; i < agg->num; i++)
+		if (used & BIT(agg->lock_order[i]))
+			mutex_lock(&agg->chips[agg->lock_order[i]]->i2c_lock);
 }
 
-static void kts1622_irq_shutdown(struct irq_data *d)
+static void kts1622_aggregate_unlock(struct kts1622_aggregate *agg, unsigned long used)
 {
-	struct gpio_chip *gc = irq_data_get_irq_chip_data(d);
-	struct kts1622_chip *chip = gpiochip_get_data(gc);
+	int i;
 
-	chip->irq_edge[d->hwirq/4] &= ~(0x03 << (d->hwirq % 4));
+	for_each_set_bit(i, &used, agg->num)
+		mutex_unlock(&agg->chips[i]->i2c_lock);
 }
 
-static irqreturn_t kts1622_irq_handler(int irq, void *devid)
+static void kts1622_aggregate_set_multiple(struct gpio_chip *gc,
+					   unsigned long *mask,
+					   unsigned long *bits)
 {
-	struct kts1622_chip *chip = devid;
-	int nhandled = 0;
-	int port = 0;
-	int pin = 0;
-	u8 irq_status[2];
+	struct kts1622_aggregate *agg = gpiochip_get_data(gc);
+	struct kts1622_chip *owners[KTS1622_AGGREGATE_MAX];
+	struct i2c_msg msgs[KTS1622_AGGREGATE_MAX];
+	u8 buf[KTS1622_AGGREGATE_MAX][1 + NUM_PORTS];
+	unsigned long used = 0;
+	int n = 0;
+	int port;
+	int i;
+
+	for (i = 0; i < agg->num; i++)
+		for (port = 0; port < agg->nports; port++)
+			if (bitmap_get_value8(mask, i * agg->chip_ngpio + port * NUM_PINS_PER_PORT))
+				used |= BIT(i);
+	if (!used)
+		return;
+
+	kts1622_aggregate_lock(agg, used);
+
+	for_each_set_bit(i, &used, agg->num) {
+		struct kts1622_chip *chip = agg->chips[i];
 
-	for (port = 0; port < NUM_PORTS; port++) {
-		/* Read to check which line is the cause of the interrupt */
-		kts1622_reg_read(chip, KTS1622_INTERRUPT_STATUS_0 + port, &irq_status[port]);
+		buf[n][0] = KTS1622_OUTPUT_0;
+		for (port = 0; port < agg->nports; port++) {
+			unsigned int start = i * agg->chip_ngpio + port * NUM_PINS_PER_PORT;
+			u8 m = bitmap_get_value8(mask, start);
+			u8 b = bitmap_get_value8(bits, start);
 
-		/* Clear the interrupt flags */
-		if (irq_status[port] != 0x00)
-			kts1622_reg_write(chip, KTS1622_INTERRUPT_CLEAR_0 + port, irq_status[port]);
+			buf[n][1 + port] = (chip->reg_cache[KTS1622_OUTPUT_0 + port] & ~m) |
+					   (b & m);
+		}
+
+		owners[n] = chip;
+		msgs[n].addr = chip->client->addr;
+		msgs[n].flags = 0;
+		msgs[n].len = 1 + agg->nports;
+		msgs[n].buf = buf[n];
+		n++;
 	}
 
-	for (port = 0; port < NUM_PORTS; port++) {
-		for (pin = 0; pin < NUM_PINS_PER_PORT; pin++) {
-			if ((irq_status[port] >> pin) & 0x01) {
-				handle_nested_irq(irq_find_mapping(chip->gpio_chip.irq.domain, port * NUM_PINS_PER_PORT + pin));
-				nhandled++;
-			}
+	if (agg->raw_i2c) {
+		if (kts1622_xfer_msgs(owners, msgs, n) == 0) {
+			n = 0;
+			for_each_set_bit(i, &used, agg->num)
+				kts1622_cache_update(agg->chips[i], KTS1622_OUTPUT_0,
+						     agg->nports, &buf[n++][1]);
 		}
+	} else {
+		n = 0;
+		for_each_set_bit(i, &used, agg->num)
+			kts1622_reg_write_block(agg->chips[i], KTS1622_OUTPUT_0,
+						agg->nports, &buf[n++][1]);
 	}
 
-	return (nhandled > 0) ? IRQ_HANDLED : IRQ_NONE;
+	kts1622_aggregate_unlock(agg, used);
 }
 
-static int kts1622_irq_setup(struct kts1622_chip *chip)
+static int kts1622_aggregate_get_multiple(struct gpio_chip *gc,
+					  unsigned long *mask,
+					  unsigned long *bits)
 {
-	struct i2c_client *client = chip->client;
-	struct irq_chip *irq_chip = &chip->irq_chip;
+	struct kts1622_aggregate *agg = gpiochip_get_data(gc);
+	struct kts1622_chip *owners[KTS1622_AGGREGATE_MAX * 2];
+	struct i2c_msg msgs[KTS1622_AGGREGATE_MAX * 2];
+	u8 input[KTS1622_AGGREGATE_MAX][NUM_PORTS];
+	u8 input_reg = KTS1622_INPUT_0;
+	unsigned long used = 0;
+	int n = 0;
 	int port;
-	int ret;
-
-	if (!client->irq)
-		return 0;
+	int ret = 0;
+	int i;
 
-	if (chip->irq_base == -1)
+	for (i = 0; i < agg->num; i++)
+		for (port = 0; port < agg->nports; port++)
+			if (bitmap_get_value8(mask, i * agg->chip_ngpio + port * NUM_PINS_PER_PORT))
+				used |= BIT(i);
+	if (!used)
 		return 0;
 
-	mutex_init(&chip->irq_lock);
+	kts1622_aggregate_lock(agg, used);
+
+	if (agg->raw_i2c) {
+		for_each_set_bit(i, &used, agg->num) {
+			owners[n * 2] = agg->chips[i];
+			owners[n * 2 + 1] = agg->chips[i];
+			msgs[n * 2].addr = agg->chips[i]->client->addr;
+			msgs[n * 2].flags = 0;
+			msgs[n * 2].len = 1;
+			msgs[n * 2].buf = &input_reg;
+			msgs[n * 2 + 1].addr = agg->chips[i]->client->addr;
+			msgs[n * 2 + 1].flags = I2C_M_RD;
+			msgs[n * 2 + 1].len = agg->nports;
+			msgs[n * 2 + 1].buf = input[n];
+			n++;
+		}
 
-	ret = devm_request_threaded_irq(&client->dev, client->irq,
-					NULL, kts1622_irq_handler,
-					IRQF_ONESHOT,
-					dev_name(&client->dev), chip);
-	if (ret) {
-		dev_err(&client->dev, "failed to request irq %d\n",
-			client->irq);
-		return ret;
+		ret = kts1622_xfer_msgs(owners, msgs, n * 2);
+	} else {
+		for_each_set_bit(i, &used, agg->num) {
+			ret = kts1622_reg_read_block(agg->chips[i], KTS1622_INPUT_0,
+						     agg->nports, input[n++]);
+			if (ret < 0)
+				break;
+		}
 	}
 
-	irq_chip->name = dev_name(&chip->client->dev);
-	irq_chip->irq_mask = kts1622_irq_mask;
-	irq_chip->irq_unmask = kts1622_irq_unmask;
-	irq_chip->irq_bus_lock = kts1622_irq_bus_lock;
-	irq_chip->irq_bus_sync_unlock = kts1622_irq_bus_sync_unlock;
-	irq_chip->irq_set_type = kts1622_irq_set_type;
-	irq_chip->irq_shutdown = kts1622_irq_shutdown;
-
-	for (port=0; port<NUM_PORTS; port++) {
-		kts1622_reg_read(chip, KTS1622_INTERRUPT_MASK_0 + port, &chip->irq_mask[port]);
-		kts1622_reg_read(chip, KTS1622_INTERRUPT_EDGE_0A + port*2, &chip->irq_edge[port*2]);
-		kts1622_reg_read(chip, KTS1622_INTERRUPT_EDGE_0A + port*2 + 1, &chip->irq_edge[port*2 + 1]);
+	if (ret >= 0) {
+		n = 0;
+		for_each_set_bit(i, &used, agg->num) {
+			for (port = 0; port < agg->nports; port++)
+				input[n][port] = kts1622_latch_take(agg->chips[i], port,
+					bitmap_get_value8(mask, i * agg->chip_ngpio +
+							  port * NUM_PINS_PER_PORT),
+					input[n][port]);
+			n++;
+		}
 	}
 
-	ret =  gpiochip_irqchip_add_nested(&chip->gpio_chip, irq_chip,
-					   chip->irq_base, handle_simple_irq,
-					   IRQ_TYPE_NONE);
-	if (ret) {
-		dev_err(&client->dev,
-			"could not connect irqchip to gpiochip\n");
+	kts1622_aggregate_unlock(agg, used);
+
+	if (ret < 0)
 		return ret;
-	}
 
-	gpiochip_set_nested_irqchip(&chip->gpio_chip, irq_chip, client->irq);
+	n = 0;
+	for_each_set_bit(i, &used, agg->num) {
+		for (port = 0; port < agg->nports; port++) {
+			unsigned int start = i * agg->chip_ngpio + port * NUM_PINS_PER_PORT;
+			u8 m = bitmap_get_value8(mask, start);
+			u8 b = bitmap_get_value8(bits, start);
+
+			bitmap_set_value8(bits, (b & ~m) | (input[n][port] & m), start);
+		}
+		n++;
+	}
 
 	return 0;
 }
 
-static void kts1622_debug_show(struct seq_file *s, struct gpio_chip *gc)
+/*
+ * Look up the member chips early in probe, so a member that is not bound yet
+ * defers us before any hardware is touched. The device links unbind the
+ * aggregate before any of its members.
+ */
+static int kts1622_aggregate_lookup(struct kts1622_chip *chip)
 {
-	struct kts1622_chip *chip = gpiochip_get_data(gc);
-	u8 reg_addr;
-	u8 reg_val;
-	int ret;
+	struct kts1622_aggregate *agg = &chip->aggregate;
+	struct device *dev = &chip->client->dev;
+	struct device_node *np;
+	int count;
+	int i;
+
+	count = of_count_phandle_with_args(dev->of_node,
+					   "kinetic_technologies,aggregate", NULL);
+	if (count <= 0)
+		return 0;
 
-	seq_puts(s, "regs:\n");
-	for (reg_addr = 0; reg_addr <= 7; reg_addr++) {
-		ret = kts1622_reg_read(chip, reg_addr, &reg_val);
-		if (ret < 0)
-			goto error;
-		seq_printf(s, " 0x%02X: 0x%02X\n", reg_addr, reg_val);
+	if (count + 1 > KTS1622_AGGREGATE_MAX) {
+		dev_err(dev, "at most %d chips can be aggregated\n",
+			KTS1622_AGGREGATE_MAX);
+		return -EINVAL;
 	}
-	for (reg_addr = 0x40; reg_addr <= 0x5A; reg_addr++) {
-		if (reg_addr == 0x4E)
-			continue; /* Reserved */
 
-		ret = kts1622_reg_read(chip, reg_addr, &reg_val);
-		if (ret < 0)
-			goto error;
+	agg->chips[0] = chip;
+	agg->num = 1;
+	agg->nports = chip->nports;
+	agg->chip_ngpio = chip->nports * NUM_PINS_PER_PORT;
+
+	for (i = 0; i < count; i++) {
+		struct i2c_client *client;
+		struct kts1622_chip *member;
+
+		np = of_parse_phandle(dev->of_node, "kinetic_technologies,aggregate", i);
+		if (!np)
+			return -EINVAL;
+		client = of_find_i2c_device_by_node(np);
+		of_node_put(np);
+		if (!client)
+			return -EPROBE_DEFER;
+
+		member = i2c_get_clientdata(client);
+		if (!member || !smp_load_acquire(&member->probed)) {
+			put_device(&client->dev);
+			return -EPROBE_DEFER;
+		}
 
-		seq_printf(s, " 0x%02X: 0x%02X\n", reg_addr, reg_val);
+		if (client->adapter != chip->client->adapter ||
+		    member->info != chip->info || member->keypad.enabled) {
+			dev_err(dev, "%s cannot be aggregated\n", dev_name(&client->dev));
+			put_device(&client->dev);
+			return -EINVAL;
+		}
+
+		if (!device_link_add(dev, &client->dev, DL_FLAG_AUTOREMOVE_CONSUMER)) {
+			put_device(&client->dev);
+			return -EINVAL;
+		}
+		put_device(&client->dev);
+
+		agg->chips[agg->num++] = member;
 	}
-	return;
-error:
-	seq_printf(s, "Failed to read KTS1622 registers (ret=%d).", ret);
-}
 
-static void kts1622_setup_gpio(struct kts1622_chip *chip)
-{
-	struct gpio_chip *gc;
+	agg->raw_i2c = chip->xfer.raw;
 
-	gc = &chip->gpio_chip;
+	for (i = 0; i < agg->num; i++) {
+		int j = i;
 
-	gc->direction_input  = kts1622_gpio_direction_input;
-	gc->direction_output = kts1622_gpio_direction_output;
-	gc->get = kts1622_gpio_get_value;
-	gc->set = kts1622_gpio_set_value;
-	gc->get_direction = kts1622_gpio_get_direction;
-	gc->set_config = kts1622_gpio_set_config;
-	gc->dbg_show = kts1622_debug_show;
+		while (j > 0 && kts1622_lock_rank(agg->chips[agg->lock_order[j - 1]]) >
+				kts1622_lock_rank(agg->chips[i])) {
+			agg->lock_order[j] = agg->lock_order[j - 1];
+			j--;
+		}
+		agg->lock_order[j] = i;
+	}
 
-	gc->base = -1;
-	gc->can_sleep = false;
-	gc->ngpio = 16;
-	gc->label = dev_name(&chip->client->dev);
-	gc->parent = &chip->client->dev;
-	gc->owner = THIS_MODULE;
+	return 0;
 }
 
-static int device_kts1622_init(struct kts1622_chip *chip)
+static int kts1622_aggregate_register(struct kts1622_chip *chip)
 {
-	int ret = 0;
-
-	mutex_lock(&chip->i2c_lock);
-
-	/* Software reset */
-	ret = kts1622_software_reset(chip);
-	if (ret < 0)
-		goto error;
+	struct kts1622_aggregate *agg = &chip->aggregate;
+	struct device *dev = &chip->client->dev;
+	struct gpio_chip *gc = &agg->gc;
 
-	/* Default: Input mode (push-pull when output) */
-	ret = kts1622_reg_write(chip, KTS1622_OUTPUT_PORT_CONFIG, 0x03);
-	if (ret < 0)
-		goto error;
+	if (!agg->num)
+		return 0;
 
-	ret = kts1622_reg_write(chip, KTS1622_INDIVIDUAL_PIN_OUTPUT_0, 0xFF);
-	if (ret < 0)
-		goto error;
+	gc->request = kts1622_aggregate_request;
+	gc->free = kts1622_aggregate_free;
+	gc->direction_input  = kts1622_aggregate_direction_input;
+	gc->direction_output = kts1622_aggregate_direction_output;
+	gc->get = kts1622_aggregate_get;
+	gc->set = kts1622_aggregate_set;
+	gc->get_multiple = kts1622_aggregate_get_multiple;
+	gc->set_multiple = kts1622_aggregate_set_multiple;
+	gc->get_direction = kts1622_aggregate_get_direction;
+	gc->set_config = kts1622_aggregate_set_config;
 
-	ret = kts1622_reg_write(chip, KTS1622_INDIVIDUAL_PIN_OUTPUT_1, 0xFF);
+	gc->base = -1;
+	gc->can_sleep = true;
+	gc->ngpio = agg->num * agg->chip_ngpio;
+	gc->label = devm_kasprintf(dev, GFP_KERNEL, "%s-aggregate", dev_name(dev));
+	if (!gc->label)
+		return -ENOMEM;
+	gc->parent = dev;
+	gc->owner = THIS_MODULE;
 
-error:
-	mutex_unlock(&chip->i2c_lock);
-	return ret;
+	return devm_gpiochip_add_data(dev, gc, agg);
 }
 
 static const struct of_device_id kts1622_dt_ids[];
 
+/* Runs after every other devm release, nothing takes i2c_lock any more */
+static void kts1622_lockdep_unregister(void *data)
+{
+	struct kts1622_chip *chip = data;
+
+	lockdep_unregister_key(&chip->i2c_lock_key);
+}
+
 static int kts1622_probe(struct i2c_client *client,
 			 const struct i2c_device_id *i2c_id)
 {
 	struct kts1622_chip *chip;
+	ktime_t start = ktime_get();
 	int ret;
 
 	/* Allocate, initialize, and register this gpio_chip. */
@@ -581,8 +5029,31 @@ static int kts1622_probe(struct i2c_client *client,
 
 	chip->client = client;
 
+	chip->err.retries = KTS1622_XFER_RETRIES;
+	chip->err.budget_us = KTS1622_XFER_BUDGET_US;
+	chip->err.recover_after = KTS1622_RECOVER_AFTER;
+	device_property_read_u32(&client->dev, "kinetic_technologies,xfer-retries",
+				 &chip->err.retries);
+	device_property_read_u32(&client->dev, "kinetic_technologies,xfer-budget-us",
+				 &chip->err.budget_us);
+	device_property_read_u32(&client->dev, "kinetic_technologies,recover-after",
+				 &chip->err.recover_after);
+	INIT_WORK(&chip->err.recover_work, kts1622_recover_work);
+	spin_lock_init(&chip->err.lock);
+	mutex_init(&chip->i2c_lock);
+	lockdep_register_key(&chip->i2c_lock_key);
+	lockdep_set_class(&chip->i2c_lock, &chip->i2c_lock_key);
+	ret = devm_add_action_or_reset(&client->dev, kts1622_lockdep_unregister,
+				       chip);
+	if (ret)
+		return ret;
+	mutex_init(&chip->irq_lock);
+	mutex_init(&chip->worker.lock);
+	spin_lock_init(&chip->irq_rl.lock);
+	timer_setup(&chip->irq_rl.release_timer, kts1622_irq_rl_timer, 0);
+
 	if (i2c_id) {
-		chip->driver_data = i2c_id->driver_data;
+		chip->info = &kts1622_chip_info_table[i2c_id->driver_data];
 	} else {
 		const void *match;
 
@@ -592,43 +5063,124 @@ static int kts1622_probe(struct i2c_client *client,
 			goto err_exit;
 		}
 
-		chip->driver_data = (uintptr_t)match;
+		chip->info = match;
 	}
+	chip->nports = chip->info->nports;
 
 	i2c_set_clientdata(client, chip);
 
-	kts1622_setup_gpio(chip);
+	chip->reset_gpio = devm_gpiod_get_optional(&client->dev, "reset",
+						   GPIOD_OUT_LOW);
+	if (IS_ERR(chip->reset_gpio)) {
+		ret = PTR_ERR(chip->reset_gpio);
+		goto err_exit;
+	}
+	chip->no_general_call_reset = device_property_read_bool(&client->dev,
+				"kinetic_technologies,no-general-call-reset");
+	chip->warm_attach = device_property_read_bool(&client->dev,
+				"kinetic_technologies,warm-attach");
+	chip->irq_shared = device_property_read_bool(&client->dev,
+				"kinetic_technologies,irq-shared") ||
+			   device_property_read_bool(&client->dev,
+				"kinetic_technologies,irq-group");
+
+	ret = kts1622_xfer_setup(chip);
+	if (ret)
+		goto err_exit;
 
-	mutex_init(&chip->i2c_lock);
+	ret = kts1622_worker_setup(chip);
+	if (ret)
+		goto err_exit;
+
+	ret = kts1622_aggregate_lookup(chip);
+	if (ret)
+		goto err_exit;
+
+	kts1622_setup_gpio(chip);
 
 	ret = device_kts1622_init(chip);
 	if (ret)
 		goto err_exit;
 
+	ret = kts1622_apply_init_config(chip);
+	if (ret)
+		goto err_exit;
+
+	/* In keypad mode the whole chip belongs to the matrix. */
+	if (device_property_read_bool(&client->dev, "kinetic_technologies,keypad")) {
+		ret = kts1622_keypad_setup(chip);
+		if (ret)
+			goto err_exit;
+		kts1622_debugfs_init(chip);
+		smp_store_release(&chip->probed, true);
+		return 0;
+	}
+
 	ret = devm_gpiochip_add_data(&client->dev, &chip->gpio_chip, chip);
 	if (ret)
 		goto err_exit;
 
+	ret = kts1622_pattern_setup(chip);
+	if (ret)
+		goto err_exit;
+
 	chip->irq_base = 0;
 	ret = kts1622_irq_setup(chip);
 	if (ret)
 		goto err_exit;
 
+	ret = kts1622_pwm_setup(chip);
+	if (ret)
+		goto err_exit;
+
+	ret = kts1622_aggregate_register(chip);
+	if (ret)
+		goto err_exit;
+
+	ret = kts1622_pattern_register(chip);
+	if (ret)
+		goto err_exit;
+
+	kts1622_debugfs_init(chip);
+	kts1622_pm_setup(chip);
+	smp_store_release(&chip->probed, true);
+
+	dev_dbg(&client->dev, "probed in %lld us\n",
+		ktime_us_delta(ktime_get(), start));
+
 	return 0;
 
 err_exit:
-	printk("Probe failed %d", ret);
+	kts1622_pattern_teardown(chip);
+	kts1622_recover_stop(chip);
+	kts1622_irq_rl_stop(chip);
+	kts1622_worker_stop(chip);
+	kts1622_irq_group_leave(chip);
+	kts1622_pwm_teardown(chip);
+	dev_err_probe(&client->dev, ret, "probe failed\n");
 	return ret;
 }
 
 static int kts1622_remove(struct i2c_client *client)
 {
-	/* Nothing to do for now. */
+	struct kts1622_chip *chip = i2c_get_clientdata(client);
+
+	kts1622_pattern_teardown(chip);
+	kts1622_recover_stop(chip);
+	kts1622_irq_rl_stop(chip);
+	kts1622_worker_stop(chip);
+	kts1622_irq_group_leave(chip);
+	kts1622_pm_teardown(chip);
+	kts1622_debugfs_remove(chip);
+	kts1622_keypad_teardown(chip);
+	kts1622_pwm_teardown(chip);
+
 	return 0;
 }
 
 static const struct of_device_id kts1622_dt_ids[] = {
-	{ .compatible = "kinetic_technologies,kts1622" },
+	{ .compatible = "kinetic_technologies,kts1622",
+	  .data = &kts1622_chip_info_table[KTS1622] },
 	{ }
 };
 
@@ -638,6 +5190,10 @@ static struct i2c_driver kts1622_driver = {
 	.driver = {
 		.name	= "kts1622",
 		.of_match_table = kts1622_dt_ids,
+		/* Chips probe in parallel instead of serializing the boot. */
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+		.pm = &kts1622_pm_ops,
+		.dev_groups = kts1622_groups,
 	},
 	.probe		= kts1622_probe,
 	.remove		= kts1622_remove,
@@ -646,7 +5202,21 @@ static struct i2c_driver kts1622_driver = {
 
 static int __init kts1622_init(void)
 {
-	return i2c_add_driver(&kts1622_driver);
+	int ret;
+
+	kts1622_debugfs_root = debugfs_create_dir("kts1622", NULL);
+	debugfs_create_file("trace", 0600, kts1622_debugfs_root, NULL,
+			    &kts1622_trace_fops);
+	debugfs_create_file_unsafe("trace_enable", 0600, kts1622_debugfs_root,
+				   NULL, &kts1622_trace_enable_fops);
+
+	ret = i2c_add_driver(&kts1622_driver);
+	if (ret) {
+		debugfs_remove_recursive(kts1622_debugfs_root);
+		vfree(kts1622_trace.ring);
+	}
+
+	return ret;
 }
 /* register after i2c postcore initcall and before
  * subsys initcalls that may rely on these GPIOs
@@ -656,6 +5226,8 @@ subsys_initcall(kts1622_init);
 static void __exit kts1622_exit(void)
 {
 	i2c_del_driver(&kts1622_driver);
+	debugfs_remove_recursive(kts1622_debugfs_root);
+	vfree(kts1622_trace.ring);
 }
 module_exit(kts1622_exit);
 
@@ -0,0 +1,450 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/**
+ * @brief	Simulated I2C adapter with a KTS1622 behind it, for testing the
+ *		driver without hardware
+ * @note	The adapter answers at one address with a register array that
+ *		follows the KTS1622 register map. Outputs, pulls, polarity,
+ *		input latch, interrupt mask/edge/status/clear and the general-call
+ *		reset are modelled; drive strength, open-drain and debounce are
+ *		only stored. The interrupt line comes from an irq_sim domain, so
+ *		the kernel needs CONFIG_IRQ_SIM (selected by CONFIG_GPIO_MOCKUP).
+ *
+ *		Levels on floating inputs are set through
+ *		/sys/kernel/debug/kts1622-sim/ext, and the "wire" parameter
+ *		connects output lines to input lines (loopback pairs).
+ */
+
+#include <linux/bits.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/i2c.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/irq_sim.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+
+/* Register map, as in gpio-kts1622.c */
+#define KTS1622_INPUT_0				(0x00)
+#define KTS1622_OUTPUT_0			(0x02)
+#define KTS1622_OUTPUT_1			(0x03)
+#define KTS1622_POLARITY_INVERSION_0	(0x04)
+#define KTS1622_CONFIG_0			(0x06)
+#define KTS1622_CONFIG_1			(0x07)
+#define KTS1622_DRIVE_STRENGTH_0A	(0x40)
+#define KTS1622_DRIVE_STRENGTH_1B	(0x43)
+#define KTS1622_INPUT_LATCH_0		(0x44)
+#define KTS1622_PULLUP_DOWN_ENABLE_0	(0x46)
+#define KTS1622_PULLUP_DOWN_SELECTION_0	(0x48)
+#define KTS1622_PULLUP_DOWN_SELECTION_1	(0x49)
+#define KTS1622_INTERRUPT_MASK_0	(0x4A)
+#define KTS1622_INTERRUPT_MASK_1	(0x4B)
+#define KTS1622_INTERRUPT_STATUS_0	(0x4C)
+#define KTS1622_RESERVED			(0x4E)
+#define KTS1622_INTERRUPT_EDGE_0A	(0x50)
+#define KTS1622_INTERRUPT_CLEAR_0	(0x54)
+#define KTS1622_INPUT_STATUS_0		(0x56)
+#define KTS1622_NUM_REGS			(0x5B)
+
+#define KTS1622_GENERAL_CALL_RESET	(0x06)
+
+#define NUM_PINS					(16)
+#define MAX_WIRES					(NUM_PINS)
+
+static unsigned short addr = 0x20;
+module_param(addr, ushort, 0444);
+MODULE_PARM_DESC(addr, "Address of the simulated chip (default 0x20)");
+
+static int wire[MAX_WIRES * 2];
+static int nwire;
+module_param_array(wire, int, &nwire, 0444);
+MODULE_PARM_DESC(wire, "Loopback pairs as out,in,out,in,... line numbers");
+
+static unsigned int byte_us;
+module_param(byte_us, uint, 0644);
+MODULE_PARM_DESC(byte_us, "Bus time per byte in us, 23 for 400 kHz (default 0)");
+
+static bool smbus_only;
+module_param(smbus_only, bool, 0444);
+MODULE_PARM_DESC(smbus_only, "Advertise SMBus byte data only, no plain I2C");
+
+struct kts1622_sim {
+	struct i2c_adapter adapter;
+	struct i2c_client *client;
+	struct irq_domain *irq_domain;
+	int irq;
+	struct dentry *debugfs;
+
+	struct mutex lock;	/* Register file and pin state */
+	u8 regs[KTS1622_NUM_REGS];
+	u8 ptr;			/* Register pointer for reads */
+	u16 level;		/* Pin levels, bit n is line n */
+	u16 ext;		/* Levels of undriven, unpulled lines */
+	u16 status;		/* Interrupt status */
+	u16 latched;		/* Lines whose input latch holds a value */
+	u16 latch_val;
+	u64 xfers;
+};
+
+static struct kts1622_sim *kts1622_sim;
+
+/* Power-on values of the writable registers */
+static const u8 kts1622_sim_defaults[KTS1622_NUM_REGS] = {
+	[KTS1622_OUTPUT_0 ... KTS1622_OUTPUT_1]				= 0xFF,
+	[KTS1622_CONFIG_0 ... KTS1622_CONFIG_1]				= 0xFF,
+	[KTS1622_DRIVE_STRENGTH_0A ... KTS1622_DRIVE_STRENGTH_1B]	= 0xFF,
+	[KTS1622_PULLUP_DOWN_SELECTION_0 ... KTS1622_PULLUP_DOWN_SELECTION_1] = 0xFF,
+	[KTS1622_INTERRUPT_MASK_0 ... KTS1622_INTERRUPT_MASK_1]		= 0xFF,
+};
+
+static inline u16 kts1622_sim_reg16(struct kts1622_sim *sim, u8 reg_addr)
+{
+	return sim->regs[reg_addr] | (sim->regs[reg_addr + 1] << 8);
+}
+
+static u16 kts1622_sim_levels(struct kts1622_sim *sim)
+{
+	u16 output = kts1622_sim_reg16(sim, KTS1622_OUTPUT_0);
+	u16 input = kts1622_sim_reg16(sim, KTS1622_CONFIG_0);
+	u16 pull = kts1622_sim_reg16(sim, KTS1622_PULLUP_DOWN_ENABLE_0);
+	u16 up = kts1622_sim_reg16(sim, KTS1622_PULLUP_DOWN_SELECTION_0);
+	u16 level;
+	int i;
+
+	level = (sim->ext & ~pull) | (up & pull);
+	level = (level & input) | (output & ~input);
+
+	/* A driving output wins over the input's pull */
+	for (i = 0; i + 1 < nwire; i += 2) {
+		if ((input & BIT(wire[i])) || !(input & BIT(wire[i + 1])))
+			continue;
+		if (output & BIT(wire[i]))
+			level |= BIT(wire[i + 1]);
+		else
+			level &= ~BIT(wire[i + 1]);
+	}
+
+	return level;
+}
+
+/* Follow the pins after a change, returns true if the interrupt must fire */
+static bool kts1622_sim_update(struct kts1622_sim *sim)
+{
+	u16 input = kts1622_sim_reg16(sim, KTS1622_CONFIG_0);
+	u16 latch = kts1622_sim_reg16(sim, KTS1622_INPUT_LATCH_0);
+	u16 mask = kts1622_sim_reg16(sim, KTS1622_INTERRUPT_MASK_0);
+	u16 level = kts1622_sim_levels(sim);
+	u16 changed = (level ^ sim->level) & input;
+	u16 trig = 0;
+	u16 fresh;
+	int pin;
+
+	for (pin = 0; pin < NUM_PINS; pin++) {
+		u8 edge;
+
+		if (!(changed & BIT(pin)))
+			continue;
+
+		/* 00 any change, 01 rising, 10 falling, 11 both */
+		edge = (sim->regs[KTS1622_INTERRUPT_EDGE_0A + pin / 4] >>
+			((pin % 4) * 2)) & 0x03;
+		if (!edge || edge == 0x03 ||
+		    edge == ((level & BIT(pin)) ? 0x01 : 0x02))
+			trig |= BIT(pin);
+	}
+
+	/* The latch keeps the level that caused the change until INPUT is read */
+	fresh = changed & latch & ~sim->latched;
+	sim->latched |= fresh;
+	sim->latch_val = (sim->latch_val & ~fresh) | (level & fresh);
+
+	sim->level = level;
+	trig &= ~mask;
+	sim->status |= trig;
+
+	return trig;
+}
+
+static void kts1622_sim_reset(struct kts1622_sim *sim)
+{
+	memcpy(sim->regs, kts1622_sim_defaults, KTS1622_NUM_REGS);
+	sim->status = 0;
+	sim->latched = 0;
+	sim->level = kts1622_sim_levels(sim);
+}
+
+static int kts1622_sim_read(struct kts1622_sim *sim, u8 reg_addr, u8 *val)
+{
+	int port = reg_addr & 1;
+	u16 input;
+
+	if (reg_addr >= KTS1622_NUM_REGS)
+		return -EIO;
+
+	switch (reg_addr) {
+	case KTS1622_INPUT_0 ... KTS1622_INPUT_0 + 1:
+		input = (sim->level & ~sim->latched) | (sim->latch_val & sim->latched);
+		input ^= kts1622_sim_reg16(sim, KTS1622_POLARITY_INVERSION_0);
+		*val = input >> (port * 8);
+		sim->latched &= ~(0xFF << (port * 8));
+		break;
+	case KTS1622_INTERRUPT_STATUS_0 ... KTS1622_INTERRUPT_STATUS_0 + 1:
+		*val = sim->status >> (port * 8);
+		break;
+	case KTS1622_INPUT_STATUS_0 ... KTS1622_INPUT_STATUS_0 + 1:
+		*val = sim->level >> (port * 8);
+		break;
+	case KTS1622_INTERRUPT_CLEAR_0 ... KTS1622_INTERRUPT_CLEAR_0 + 1:
+	case KTS1622_RESERVED:
+		*val = 0;
+		break;
+	default:
+		*val = sim->regs[reg_addr];
+		break;
+	}
+
+	return 0;
+}
+
+static int kts1622_sim_write(struct kts1622_sim *sim, u8 reg_addr, u8 val)
+{
+	int port = reg_addr & 1;
+
+	if (reg_addr >= KTS1622_NUM_REGS)
+		return -EIO;
+
+	switch (reg_addr) {
+	case KTS1622_INPUT_0 ... KTS1622_INPUT_0 + 1:
+	case KTS1622_INTERRUPT_STATUS_0 ... KTS1622_INTERRUPT_STATUS_0 + 1:
+	case KTS1622_INPUT_STATUS_0 ... KTS1622_INPUT_STATUS_0 + 1:
+	case KTS1622_RESERVED:
+		break;
+	case KTS1622_INTERRUPT_CLEAR_0 ... KTS1622_INTERRUPT_CLEAR_0 + 1:
+		sim->status &= ~(val << (port * 8));
+		break;
+	default:
+		sim->regs[reg_addr] = val;
+		break;
+	}
+
+	return 0;
+}
+
+static int kts1622_sim_xfer_msg(struct kts1622_sim *sim, struct i2c_msg *msg)
+{
+	int ret = 0;
+	int i;
+
+	/* General call: only the software reset is understood */
+	if (msg->addr == 0x00 && !(msg->flags & I2C_M_RD)) {
+		if (msg->len != 1 || msg->buf[0] != KTS1622_GENERAL_CALL_RESET)
+			return -ENXIO;
+		kts1622_sim_reset(sim);
+		return 0;
+	}
+
+	if (msg->addr != addr)
+		return -ENXIO;
+
+	if (msg->flags & I2C_M_RD) {
+		for (i = 0; i < msg->len && !ret; i++)
+			ret = kts1622_sim_read(sim, sim->ptr++, &msg->buf[i]);
+		return ret;
+	}
+
+	if (!msg->len)
+		return 0;
+
+	sim->ptr = msg->buf[0];
+	for (i = 1; i < msg->len && !ret; i++)
+		ret = kts1622_sim_write(sim, sim->ptr++, msg->buf[i]);
+
+	return ret;
+}
+
+static int kts1622_sim_master_xfer(struct i2c_adapter *adap,
+				   struct i2c_msg *msgs, int num)
+{
+	struct kts1622_sim *sim = i2c_get_adapdata(adap);
+	unsigned int bytes = 0;
+	u16 status;
+	bool fire;
+	int ret = 0;
+	int i;
+
+	mutex_lock(&sim->lock);
+
+	status = sim->status;
+	for (i = 0; i < num && !ret; i++) {
+		ret = kts1622_sim_xfer_msg(sim, &msgs[i]);
+		bytes += msgs[i].len + 1;
+	}
+
+	/* The line stays asserted while any status bit is left after a clear */
+	fire = kts1622_sim_update(sim) || (sim->status && sim->status != status);
+	sim->xfers++;
+
+	mutex_unlock(&sim->lock);
+
+	if (fire)
+		irq_set_irqchip_state(sim->irq, IRQCHIP_STATE_PENDING, true);
+
+	if (byte_us)
+		usleep_range(bytes * byte_us, bytes * byte_us + byte_us);
+
+	return ret ? ret : num;
+}
+
+static u32 kts1622_sim_functionality(struct i2c_adapter *adap)
+{
+	if (smbus_only)
+		return I2C_FUNC_SMBUS_BYTE | I2C_FUNC_SMBUS_BYTE_DATA;
+
+	return I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL;
+}
+
+static const struct i2c_algorithm kts1622_sim_algorithm = {
+	.master_xfer	= kts1622_sim_master_xfer,
+	.functionality	= kts1622_sim_functionality,
+};
+
+static int kts1622_sim_ext_get(void *data, u64 *val)
+{
+	struct kts1622_sim *sim = data;
+
+	*val = READ_ONCE(sim->ext);
+	return 0;
+}
+
+static int kts1622_sim_ext_set(void *data, u64 val)
+{
+	struct kts1622_sim *sim = data;
+	bool fire;
+
+	if (val > U16_MAX)
+		return -EINVAL;
+
+	mutex_lock(&sim->lock);
+	sim->ext = val;
+	fire = kts1622_sim_update(sim);
+	mutex_unlock(&sim->lock);
+
+	if (fire)
+		irq_set_irqchip_state(sim->irq, IRQCHIP_STATE_PENDING, true);
+
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(kts1622_sim_ext_fops, kts1622_sim_ext_get,
+			 kts1622_sim_ext_set, "0x%04llx\n");
+
+/* Register file as the chip holds it, without the read side effects */
+static int kts1622_sim_regs_show(struct seq_file *s, void *unused)
+{
+	struct kts1622_sim *sim = s->private;
+	int reg_addr;
+
+	mutex_lock(&sim->lock);
+	seq_printf(s, "level 0x%04x status 0x%04x latched 0x%04x\n",
+		   sim->level, sim->status, sim->latched);
+	for (reg_addr = 0; reg_addr < KTS1622_NUM_REGS; reg_addr++) {
+		if (reg_addr > KTS1622_CONFIG_1 && reg_addr < KTS1622_DRIVE_STRENGTH_0A)
+			continue;
+		seq_printf(s, "0x%02X: 0x%02X\n", reg_addr, sim->regs[reg_addr]);
+	}
+	mutex_unlock(&sim->lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(kts1622_sim_regs);
+
+static int __init kts1622_sim_init(void)
+{
+	struct i2c_board_info info = { I2C_BOARD_INFO("kts1622", 0) };
+	struct kts1622_sim *sim;
+	int ret;
+	int i;
+
+	if (nwire % 2)
+		return -EINVAL;
+	for (i = 0; i < nwire; i++)
+		if (wire[i] < 0 || wire[i] >= NUM_PINS)
+			return -EINVAL;
+	if (!addr || addr > 0x7F)
+		return -EINVAL;
+
+	sim = kzalloc(sizeof(*sim), GFP_KERNEL);
+	if (!sim)
+		return -ENOMEM;
+
+	mutex_init(&sim->lock);
+	kts1622_sim_reset(sim);
+
+	sim->irq_domain = irq_domain_create_sim(NULL, 1);
+	if (IS_ERR(sim->irq_domain)) {
+		ret = PTR_ERR(sim->irq_domain);
+		goto err_free;
+	}
+
+	sim->irq = irq_create_mapping(sim->irq_domain, 0);
+	if (!sim->irq) {
+		ret = -ENOMEM;
+		goto err_domain;
+	}
+
+	sim->adapter.owner = THIS_MODULE;
+	sim->adapter.algo = &kts1622_sim_algorithm;
+	strlcpy(sim->adapter.name, "KTS1622 simulated adapter",
+		sizeof(sim->adapter.name));
+	i2c_set_adapdata(&sim->adapter, sim);
+
+	ret = i2c_add_adapter(&sim->adapter);
+	if (ret)
+		goto err_mapping;
+
+	info.addr = addr;
+	info.irq = sim->irq;
+	sim->client = i2c_new_client_device(&sim->adapter, &info);
+	if (IS_ERR(sim->client)) {
+		ret = PTR_ERR(sim->client);
+		goto err_adapter;
+	}
+
+	sim->debugfs = debugfs_create_dir("kts1622-sim", NULL);
+	debugfs_create_file_unsafe("ext", 0600, sim->debugfs, sim,
+				   &kts1622_sim_ext_fops);
+	debugfs_create_file("regs", 0400, sim->debugfs, sim,
+			    &kts1622_sim_regs_fops);
+	debugfs_create_u64("xfers", 0400, sim->debugfs, &sim->xfers);
+
+	kts1622_sim = sim;
+	return 0;
+
+err_adapter:
+	i2c_del_adapter(&sim->adapter);
+err_mapping:
+	irq_dispose_mapping(sim->irq);
+err_domain:
+	irq_domain_remove_sim(sim->irq_domain);
+err_free:
+	kfree(sim);
+	return ret;
+}
+module_init(kts1622_sim_init);
+
+static void __exit kts1622_sim_exit(void)
+{
+	struct kts1622_sim *sim = kts1622_sim;
+
+	debugfs_remove_recursive(sim->debugfs);
+	i2c_unregister_device(sim->client);
+	i2c_del_adapter(&sim->adapter);
+	irq_dispose_mapping(sim->irq);
+	irq_domain_remove_sim(sim->irq_domain);
+	kfree(sim);
+}
+module_exit(kts1622_sim_exit);
+
+MODULE_AUTHOR("KINETIC_TECHNOLOGIES");
+MODULE_DESCRIPTION("Simulated I2C adapter with a KTS1622, for testing");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Userspace interface of the KTS1622 driver: /dev/kts1622-<device>, e.g.
+ * /dev/kts1622-1-0020 for the chip at 0x20 on i2c-1.
+ */
+#ifndef _UAPI_KTS1622_H
+#define _UAPI_KTS1622_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/**
+ * struct kts1622_wait_pattern - KTS1622_IOC_WAIT_PATTERN argument
+ * @mask: lines to compare, bit n is line n
+ * @value: their expected physical levels, no bits outside @mask
+ * @timeout_ms: < 0 waits forever, 0 only checks the current inputs
+ * @timestamp_ns: CLOCK_MONOTONIC time of the interrupt (or poll) that read
+ *	@input, set on return
+ * @input: physical levels of all lines that matched, set on return
+ * @padding: must be zero
+ */
+struct kts1622_wait_pattern {
+	__u16 mask;
+	__u16 value;
+	__s32 timeout_ms;
+	__u64 timestamp_ns;
+	__u16 input;
+	__u16 padding[3];
+};
+
+#define KTS1622_IOC_MAGIC		0xB7
+
+/*
+ * Block until (inputs & mask) == value. Returns 0, or -1 with errno set to
+ * ETIMEDOUT, EINTR, or ENODEV when the chip goes away.
+ */
+#define KTS1622_IOC_WAIT_PATTERN	_IOWR(KTS1622_IOC_MAGIC, 0x01, \
+					      struct kts1622_wait_pattern)
+
+#endif /* _UAPI_KTS1622_H */
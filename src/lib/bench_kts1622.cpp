@@ -0,0 +1,142 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/**
+ * @file bench_kts1622.cpp
+ * @brief Benchmarks and a register round-trip check for the userspace library.
+ *
+ * Runs against a real KTS1622 or against i2c-stub, which emulates the
+ * register file (SMBus only, so the batched paths fall back like they do on
+ * SMBus-only adapters):
+ * @code
+ * $ sudo modprobe i2c-dev
+ * $ sudo modprobe i2c-stub chip_addr=0x20
+ * $ i2cdetect -l | grep stub          # gives the bus number N
+ * $ sudo ./bench_kts1622 /dev/i2c-N 0x20 [loops]
+ * @endcode
+ * Every line reports the time and the number of bus transfers per operation.
+ * Do not run it against a chip with loads connected, it toggles all outputs.
+ */
+#include "kts1622.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+
+using namespace kts1622;
+
+static int bench(Device &dev, const char *name, int loops,
+		 const std::function<int(int)> &op)
+{
+	auto start = std::chrono::steady_clock::now();
+	int ret;
+	int i;
+
+	dev.resetStats();
+	for (i = 0; i < loops; i++) {
+		ret = op(i);
+		if (ret < 0) {
+			printf("%-28s failed: %s\n", name, strerror(-ret));
+			return ret;
+		}
+	}
+
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count();
+
+	printf("%-28s %9.1f us/op %6.2f transfers/op %6.2f bytes/op\n", name,
+	       ns / 1000.0 / loops, double(dev.stats().transfers) / loops,
+	       double(dev.stats().bytes) / loops);
+
+	return 0;
+}
+
+/* Write through the library, read back byte by byte, compare with the shadow */
+static int check(Device &dev)
+{
+	static const uint8_t regs[] = { OUTPUT_0, OUTPUT_1, CONFIG_0, CONFIG_1,
+					PULLUP_DOWN_ENABLE_0, INTERRUPT_MASK_1 };
+	uint8_t val;
+	int ret;
+
+	ret = dev.setOutputs(0xFFFF, 0xA55A);
+	if (ret == 0)
+		ret = dev.setDirection(0xFFFF, 0x0FF0);
+	if (ret == 0)
+		ret = dev.setPull(0x00FF, 0x0081, 0x0001);
+	if (ret == 0)
+		ret = dev.setInterruptMask(0xFF00, 0x7F00);
+	if (ret < 0)
+		return ret;
+
+	for (uint8_t reg : regs) {
+		ret = dev.readReg(reg, &val);
+		if (ret < 0)
+			return ret;
+		if (val != dev.cached(reg)) {
+			printf("register 0x%02X: chip 0x%02X, shadow 0x%02X\n",
+			       reg, val, dev.cached(reg));
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	Device dev;
+	uint16_t in;
+	uint16_t status;
+	int loops = argc > 3 ? atoi(argv[3]) : 1000;
+	int ret;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s /dev/i2c-N addr [loops]\n", argv[0]);
+		return 1;
+	}
+
+	ret = dev.open(argv[1], strtoul(argv[2], NULL, 0));
+	if (ret < 0) {
+		fprintf(stderr, "%s: %s\n", argv[1], strerror(-ret));
+		return 1;
+	}
+
+	printf("paths: single %s, pair %s, bulk %s\n", xferName(dev.path(1)),
+	       xferName(dev.path(2)), xferName(dev.path(10)));
+
+	ret = check(dev);
+	printf("register check: %s\n", ret ? "FAILED" : "ok");
+	if (ret)
+		return 1;
+
+	bench(dev, "read 16 inputs", loops, [&](int) {
+		return dev.readInputs(&in);
+	});
+	bench(dev, "read 16 inputs, per byte", loops, [&](int) {
+		uint8_t b[2];
+		int r = dev.readReg(INPUT_0, &b[0]);
+
+		return r ? r : dev.readReg(INPUT_1, &b[1]);
+	});
+	bench(dev, "write 16 outputs", loops, [&](int i) {
+		return dev.setOutputs(0xFFFF, i & 1 ? 0xFFFF : 0x0000);
+	});
+	bench(dev, "toggle one output", loops, [&](int i) {
+		return dev.setOutputs(0x0001, i & 1);
+	});
+	bench(dev, "rewrite same outputs", loops, [&](int) {
+		return dev.setOutputs(0xFFFF, dev.cached(OUTPUT_0) |
+					      (dev.cached(OUTPUT_1) << 8));
+	});
+	bench(dev, "status + inputs, batched", loops, [&](int) {
+		return Batch(dev).read16(INTERRUPT_STATUS_0, &status)
+				 .read16(INPUT_0, &in)
+				 .commit();
+	});
+	bench(dev, "read all config", loops / 10 + 1, [&](int) {
+		return dev.syncFromChip();
+	});
+
+	return 0;
+}
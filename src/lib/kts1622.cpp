@@ -0,0 +1,648 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/**
+ * @file kts1622.cpp
+ * @brief Userspace access to the KTS1622 over i2c-dev, see kts1622.hpp.
+ */
+#include "kts1622.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/gpio.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+namespace kts1622 {
+
+#define KTS1622_GENERAL_CALL_RESET	(0x06)
+
+/* Same runs as kts1622_reg_ranges[] in the driver */
+static const struct {
+	uint8_t first;
+	uint8_t last;
+} reg_ranges[] = {
+	{ DRIVE_STRENGTH_0A, INTERRUPT_MASK_1 },
+	{ OUTPUT_PORT_CONFIG, INTERRUPT_EDGE_1B },
+	{ INDIVIDUAL_PIN_OUTPUT_0, SWITCH_DEBOUNCE_ENABLE },
+	{ OUTPUT_0, CONFIG_1 },
+};
+
+static const char * const xfer_names[XFER_NUM] = {
+	"smbus-byte",
+	"smbus-word",
+	"smbus-i2c-block",
+	"i2c",
+};
+
+const char *xferName(Xfer path)
+{
+	return path < XFER_NUM ? xfer_names[path] : "?";
+}
+
+/* Registers that change behind our back or are write-only strobes */
+bool isVolatile(uint8_t reg)
+{
+	switch (reg) {
+	case INPUT_0:
+	case INPUT_1:
+	case INTERRUPT_STATUS_0:
+	case INTERRUPT_STATUS_1:
+	case INTERRUPT_CLEAR_0:
+	case INTERRUPT_CLEAR_1:
+	case INPUT_STATUS_0:
+	case INPUT_STATUS_1:
+		return true;
+	default:
+		return reg >= NUM_REGS;
+	}
+}
+
+/* Power-on values of the writable registers, as kts1622_reg_defaults[] */
+void loadDefaults(uint8_t *cache)
+{
+	memset(cache, 0, NUM_REGS);
+	cache[OUTPUT_0] = 0xFF;
+	cache[OUTPUT_1] = 0xFF;
+	cache[CONFIG_0] = 0xFF;
+	cache[CONFIG_1] = 0xFF;
+	memset(&cache[DRIVE_STRENGTH_0A], 0xFF, 4);
+	cache[PULLUP_DOWN_SELECTION_0] = 0xFF;
+	cache[PULLUP_DOWN_SELECTION_1] = 0xFF;
+	cache[INTERRUPT_MASK_0] = 0xFF;
+	cache[INTERRUPT_MASK_1] = 0xFF;
+}
+
+Device::Device()
+	: fd_(-1), irq_fd_(-1), addr_(0), raw_(false), supported_(0)
+{
+	loadDefaults(cache_);
+}
+
+Device::~Device()
+{
+	close();
+}
+
+int Device::open(const std::string &bus, uint8_t addr)
+{
+	unsigned long funcs;
+
+	close();
+
+	fd_ = ::open(bus.c_str(), O_RDWR | O_CLOEXEC);
+	if (fd_ < 0)
+		return -errno;
+
+	if (ioctl(fd_, I2C_FUNCS, &funcs) < 0 ||
+	    ioctl(fd_, I2C_SLAVE, addr) < 0) {
+		int ret = -errno;
+
+		close();
+		return ret;
+	}
+
+	addr_ = addr;
+	supported_ = 0;
+	if (funcs & I2C_FUNC_SMBUS_BYTE_DATA)
+		supported_ |= 1u << XFER_BYTE;
+	if (funcs & I2C_FUNC_SMBUS_WORD_DATA)
+		supported_ |= 1u << XFER_SMBUS_WORD;
+	if (funcs & I2C_FUNC_SMBUS_I2C_BLOCK)
+		supported_ |= 1u << XFER_SMBUS_BLOCK;
+	if (funcs & I2C_FUNC_I2C)
+		supported_ |= 1u << XFER_RAW;
+
+	if (!(supported_ & ((1u << XFER_BYTE) | (1u << XFER_RAW)))) {
+		close();
+		return -ENODEV;
+	}
+	raw_ = supported_ & (1u << XFER_RAW);
+
+	return 0;
+}
+
+void Device::close()
+{
+	if (irq_fd_ >= 0)
+		::close(irq_fd_);
+	if (fd_ >= 0)
+		::close(fd_);
+	irq_fd_ = -1;
+	fd_ = -1;
+}
+
+/* Single registers prefer SMBus byte accesses, longer runs the most capable path */
+Xfer Device::path(uint8_t len) const
+{
+	uint32_t candidates = supported_;
+	int path;
+
+	if (len == 1) {
+		candidates &= (1u << XFER_BYTE) | (1u << XFER_RAW);
+		return static_cast<Xfer>(__builtin_ctz(candidates));
+	}
+	if (len != 2)
+		candidates &= ~(1u << XFER_SMBUS_WORD);
+
+	path = 31 - __builtin_clz(candidates);
+	return static_cast<Xfer>(path);
+}
+
+int Device::rdwr(struct i2c_msg *msgs, unsigned int n)
+{
+	struct i2c_rdwr_ioctl_data data = { msgs, n };
+	unsigned int i;
+
+	stats_.transfers++;
+	stats_.messages += n;
+	for (i = 0; i < n; i++)
+		stats_.bytes += msgs[i].len;
+
+	if (ioctl(fd_, I2C_RDWR, &data) < 0)
+		return -errno;
+
+	return 0;
+}
+
+int Device::smbus(uint8_t rw, uint8_t cmd, int size, union i2c_smbus_data *data)
+{
+	struct i2c_smbus_ioctl_data args = { rw, cmd, static_cast<__u32>(size), data };
+
+	stats_.transfers++;
+	stats_.messages += rw == I2C_SMBUS_READ ? 2 : 1;
+	stats_.bytes += 1 + (size == I2C_SMBUS_BYTE_DATA ? 1 :
+			     size == I2C_SMBUS_WORD_DATA ? 2 :
+			     size == I2C_SMBUS_I2C_BLOCK_DATA ? data->block[0] : 0);
+
+	if (ioctl(fd_, I2C_SMBUS, &args) < 0)
+		return -errno;
+
+	return 0;
+}
+
+int Device::xferRead(Xfer path, uint8_t reg, uint8_t len, uint8_t *buf)
+{
+	union i2c_smbus_data data;
+	int ret;
+	int i;
+
+	switch (path) {
+	case XFER_RAW: {
+		struct i2c_msg msgs[2] = {
+			{ addr_, 0, 1, &reg },
+			{ addr_, I2C_M_RD, len, buf },
+		};
+
+		return rdwr(msgs, 2);
+	}
+
+	case XFER_SMBUS_BLOCK:
+		while (len) {
+			uint8_t n = std::min<uint8_t>(len, I2C_SMBUS_BLOCK_MAX);
+
+			data.block[0] = n;
+			ret = smbus(I2C_SMBUS_READ, reg, I2C_SMBUS_I2C_BLOCK_DATA, &data);
+			if (ret < 0)
+				return ret;
+			memcpy(buf, &data.block[1], n);
+			reg += n;
+			buf += n;
+			len -= n;
+		}
+		return 0;
+
+	case XFER_SMBUS_WORD:
+		if (len != 2)
+			break;
+		ret = smbus(I2C_SMBUS_READ, reg, I2C_SMBUS_WORD_DATA, &data);
+		if (ret < 0)
+			return ret;
+		buf[0] = data.word & 0xFF;
+		buf[1] = data.word >> 8;
+		return 0;
+
+	default:
+		break;
+	}
+
+	for (i = 0; i < len; i++) {
+		ret = smbus(I2C_SMBUS_READ, reg + i, I2C_SMBUS_BYTE_DATA, &data);
+		if (ret < 0)
+			return ret;
+		buf[i] = data.byte;
+	}
+
+	return 0;
+}
+
+int Device::xferWrite(Xfer path, uint8_t reg, uint8_t len, const uint8_t *buf)
+{
+	union i2c_smbus_data data;
+	int ret;
+	int i;
+
+	switch (path) {
+	case XFER_RAW: {
+		uint8_t msg[NUM_REGS + 1];
+		struct i2c_msg msgs[1] = {
+			{ addr_, 0, static_cast<__u16>(len + 1), msg },
+		};
+
+		msg[0] = reg;
+		memcpy(&msg[1], buf, len);
+		return rdwr(msgs, 1);
+	}
+
+	case XFER_SMBUS_BLOCK:
+		while (len) {
+			uint8_t n = std::min<uint8_t>(len, I2C_SMBUS_BLOCK_MAX);
+
+			data.block[0] = n;
+			memcpy(&data.block[1], buf, n);
+			ret = smbus(I2C_SMBUS_WRITE, reg, I2C_SMBUS_I2C_BLOCK_DATA, &data);
+			if (ret < 0)
+				return ret;
+			reg += n;
+			buf += n;
+			len -= n;
+		}
+		return 0;
+
+	case XFER_SMBUS_WORD:
+		if (len != 2)
+			break;
+		data.word = buf[0] | (buf[1] << 8);
+		return smbus(I2C_SMBUS_WRITE, reg, I2C_SMBUS_WORD_DATA, &data);
+
+	default:
+		break;
+	}
+
+	for (i = 0; i < len; i++) {
+		data.byte = buf[i];
+		ret = smbus(I2C_SMBUS_WRITE, reg + i, I2C_SMBUS_BYTE_DATA, &data);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+void Device::cacheUpdate(uint8_t reg, uint8_t len, const uint8_t *buf)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		if (!isVolatile(reg + i))
+			cache_[reg + i] = buf[i];
+}
+
+int Device::readBlock(uint8_t reg, uint8_t len, uint8_t *buf)
+{
+	int ret;
+
+	if (fd_ < 0)
+		return -EBADF;
+
+	ret = xferRead(path(len), reg, len, buf);
+	if (ret == 0)
+		cacheUpdate(reg, len, buf);
+
+	return ret;
+}
+
+int Device::writeBlock(uint8_t reg, uint8_t len, const uint8_t *buf)
+{
+	int ret;
+
+	if (fd_ < 0)
+		return -EBADF;
+
+	ret = xferWrite(path(len), reg, len, buf);
+	if (ret == 0)
+		cacheUpdate(reg, len, buf);
+
+	return ret;
+}
+
+int Device::readReg(uint8_t reg, uint8_t *val)
+{
+	return readBlock(reg, 1, val);
+}
+
+int Device::writeReg(uint8_t reg, uint8_t val)
+{
+	return writeBlock(reg, 1, &val);
+}
+
+int Device::updateBits(uint8_t reg, uint8_t mask, uint8_t val)
+{
+	uint8_t reg_val = (cache_[reg] & ~mask) | (val & mask);
+
+	if (reg_val == cache_[reg])
+		return 0;
+
+	return writeReg(reg, reg_val);
+}
+
+int Device::reset()
+{
+	uint8_t cmd = KTS1622_GENERAL_CALL_RESET;
+	int ret;
+
+	if (fd_ < 0)
+		return -EBADF;
+
+	if (raw_) {
+		struct i2c_msg msgs[1] = { { 0x00, 0, 1, &cmd } };
+
+		ret = rdwr(msgs, 1);
+	} else {
+		ret = ioctl(fd_, I2C_SLAVE, 0x00) < 0 ? -errno : 0;
+		if (ret == 0) {
+			ret = smbus(I2C_SMBUS_WRITE, cmd, I2C_SMBUS_BYTE, nullptr);
+			if (ioctl(fd_, I2C_SLAVE, addr_) < 0 && ret == 0)
+				ret = -errno;
+		}
+	}
+
+	if (ret == 0)
+		loadDefaults(cache_);
+
+	return ret;
+}
+
+int Device::syncFromChip()
+{
+	Batch batch(*this);
+	uint8_t regs[NUM_REGS];
+
+	for (const auto &range : reg_ranges)
+		batch.read(range.first, &regs[range.first],
+			   range.last - range.first + 1);
+
+	return batch.commit();
+}
+
+/*
+ * Write the bytes of a port pair that change. Both bytes go out in one
+ * transfer, a single changed byte as a byte access like the driver does.
+ */
+int Device::port16(uint8_t reg, uint16_t mask, uint16_t val)
+{
+	uint8_t buf[2];
+	bool changed[2];
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		uint8_t m = mask >> (i * 8);
+
+		buf[i] = (cache_[reg + i] & ~m) | ((val >> (i * 8)) & m);
+		changed[i] = buf[i] != cache_[reg + i];
+	}
+
+	if (changed[0] && changed[1])
+		return writeBlock(reg, 2, buf);
+	if (changed[0])
+		return writeReg(reg, buf[0]);
+	if (changed[1])
+		return writeReg(reg + 1, buf[1]);
+
+	return 0;
+}
+
+int Device::readInputs(uint16_t *val)
+{
+	uint8_t buf[2];
+	int ret;
+
+	ret = readBlock(INPUT_0, 2, buf);
+	if (ret == 0)
+		*val = buf[0] | (buf[1] << 8);
+
+	return ret;
+}
+
+int Device::setOutputs(uint16_t mask, uint16_t val)
+{
+	return port16(OUTPUT_0, mask, val);
+}
+
+int Device::setDirection(uint16_t mask, uint16_t inputs)
+{
+	return port16(CONFIG_0, mask, inputs);
+}
+
+int Device::setPolarity(uint16_t mask, uint16_t inverted)
+{
+	return port16(POLARITY_INVERSION_0, mask, inverted);
+}
+
+/* Select before enable, so a line never pulls the wrong way */
+int Device::setPull(uint16_t mask, uint16_t enable, uint16_t up)
+{
+	int ret;
+
+	ret = port16(PULLUP_DOWN_SELECTION_0, mask, up);
+	if (ret < 0)
+		return ret;
+
+	return port16(PULLUP_DOWN_ENABLE_0, mask, enable);
+}
+
+/* INDIVIDUAL_PIN_OUTPUT: 1 = push-pull, 0 = open-drain */
+int Device::setOpenDrain(uint16_t mask, uint16_t open_drain)
+{
+	return port16(INDIVIDUAL_PIN_OUTPUT_0, mask, ~open_drain);
+}
+
+int Device::setInterruptMask(uint16_t mask, uint16_t masked)
+{
+	return port16(INTERRUPT_MASK_0, mask, masked);
+}
+
+int Device::attachInterrupt(const std::string &gpiochip, unsigned int line)
+{
+	struct gpioevent_request req;
+	int chip_fd;
+	int ret = 0;
+
+	chip_fd = ::open(gpiochip.c_str(), O_RDWR | O_CLOEXEC);
+	if (chip_fd < 0)
+		return -errno;
+
+	memset(&req, 0, sizeof(req));
+	req.lineoffset = line;
+	req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	req.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+	strncpy(req.consumer_label, "kts1622-int", sizeof(req.consumer_label) - 1);
+
+	if (ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &req) < 0)
+		ret = -errno;
+	::close(chip_fd);
+	if (ret < 0)
+		return ret;
+
+	if (irq_fd_ >= 0)
+		::close(irq_fd_);
+	irq_fd_ = req.fd;
+
+	return 0;
+}
+
+int Device::waitInterrupt(int timeout_ms, uint16_t *status, uint16_t *input)
+{
+	struct gpiohandle_data level;
+	struct gpioevent_data event;
+	struct pollfd pfd;
+	uint8_t clear[2];
+	int ret;
+
+	if (irq_fd_ < 0)
+		return -EINVAL;
+
+	*status = 0;
+
+	/* INT is a level: an interrupt that is already pending has no edge left */
+	if (ioctl(irq_fd_, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &level) < 0)
+		return -errno;
+
+	if (level.values[0]) {
+		pfd.fd = irq_fd_;
+		pfd.events = POLLIN;
+		ret = poll(&pfd, 1, timeout_ms);
+		if (ret < 0)
+			return -errno;
+		if (ret == 0)
+			return 0;
+	}
+
+	/* Drain the edge events, the status registers say what happened */
+	pfd.fd = irq_fd_;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, 0) > 0)
+		if (read(irq_fd_, &event, sizeof(event)) != sizeof(event))
+			break;
+
+	/* Status and input in one transfer, as kts1622_irq_read_state() */
+	ret = Batch(*this).read16(INTERRUPT_STATUS_0, status)
+			  .read16(INPUT_0, input)
+			  .commit();
+	if (ret < 0 || !*status)
+		return ret;
+
+	clear[0] = *status & 0xFF;
+	clear[1] = *status >> 8;
+
+	return writeBlock(INTERRUPT_CLEAR_0, 2, clear);
+}
+
+Batch &Batch::read(uint8_t reg, uint8_t *buf, uint8_t len)
+{
+	Op op = {};
+
+	op.reg = reg;
+	op.len = len;
+	op.read = true;
+	op.dst = buf;
+	op.data[0] = reg;
+	ops_.push_back(op);
+
+	return *this;
+}
+
+Batch &Batch::write(uint8_t reg, const uint8_t *buf, uint8_t len)
+{
+	Op op = {};
+
+	op.reg = reg;
+	op.len = len;
+	op.data[0] = reg;
+	memcpy(&op.data[1], buf, len);
+	ops_.push_back(op);
+
+	return *this;
+}
+
+Batch &Batch::read16(uint8_t reg, uint16_t *val)
+{
+	Op op = {};
+
+	op.reg = reg;
+	op.len = 2;
+	op.read = true;
+	op.dst16 = val;
+	op.data[0] = reg;
+	ops_.push_back(op);
+
+	return *this;
+}
+
+Batch &Batch::write16(uint8_t reg, uint16_t val)
+{
+	uint8_t buf[2] = { static_cast<uint8_t>(val), static_cast<uint8_t>(val >> 8) };
+
+	return write(reg, buf, 2);
+}
+
+int Batch::commit()
+{
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	size_t first = 0;
+	int ret = 0;
+
+	if (dev_.fd_ < 0)
+		return -EBADF;
+
+	while (first < ops_.size() && ret == 0) {
+		unsigned int n = 0;
+		size_t last = first;
+
+		if (!dev_.raw_) {
+			Op &op = ops_[last++];
+
+			if (op.read)
+				ret = dev_.readBlock(op.reg, op.len, &op.data[1]);
+			else
+				ret = dev_.writeBlock(op.reg, op.len, &op.data[1]);
+		} else {
+			/* A read is two messages, a write one */
+			while (last < ops_.size() &&
+			       n + (ops_[last].read ? 2 : 1) <= I2C_RDWR_IOCTL_MAX_MSGS) {
+				Op &op = ops_[last++];
+
+				msgs[n++] = { dev_.addr_, 0,
+					      static_cast<__u16>(op.read ? 1 : op.len + 1),
+					      op.data };
+				if (op.read)
+					msgs[n++] = { dev_.addr_, I2C_M_RD, op.len, &op.data[1] };
+			}
+
+			ret = dev_.rdwr(msgs, n);
+			for (size_t i = first; ret == 0 && i < last; i++)
+				dev_.cacheUpdate(ops_[i].reg, ops_[i].len, &ops_[i].data[1]);
+		}
+
+		for (size_t i = first; ret == 0 && i < last; i++) {
+			Op &op = ops_[i];
+
+			if (op.dst)
+				memcpy(op.dst, &op.data[1], op.len);
+			if (op.dst16)
+				*op.dst16 = op.data[1] | (op.data[2] << 8);
+		}
+		first = last;
+	}
+
+	ops_.clear();
+
+	return ret;
+}
+
+} /* namespace kts1622 */
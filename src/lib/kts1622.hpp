@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/**
+ * @file kts1622.hpp
+ * @brief Userspace access to the KTS1622 over i2c-dev.
+ *
+ * Mirrors the register model of the kernel driver (src/drivers/gpio-kts1622.c)
+ * for systems that cannot load the module: the same register map, a shadow of
+ * the writable registers so read-modify-write costs no bus read, and the same
+ * choice of transfer path per access size. A bus operation costs the same
+ * number of transfers as in the driver.
+ *
+ * Port operations take 16-bit words, bit n is line n (port A is the low byte).
+ * All functions return 0 or a negative errno, like the driver helpers.
+ */
+#ifndef KTS1622_HPP
+#define KTS1622_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct i2c_msg;
+union i2c_smbus_data;
+
+namespace kts1622 {
+
+/* Registers, as KTS1622_* in the driver */
+enum Reg : uint8_t {
+	INPUT_0				= 0x00,
+	INPUT_1				= 0x01,
+	OUTPUT_0			= 0x02,
+	OUTPUT_1			= 0x03,
+	POLARITY_INVERSION_0		= 0x04,
+	POLARITY_INVERSION_1		= 0x05,
+	CONFIG_0			= 0x06,
+	CONFIG_1			= 0x07,
+
+	DRIVE_STRENGTH_0A		= 0x40,
+	DRIVE_STRENGTH_0B		= 0x41,
+	DRIVE_STRENGTH_1A		= 0x42,
+	DRIVE_STRENGTH_1B		= 0x43,
+	INPUT_LATCH_0			= 0x44,
+	INPUT_LATCH_1			= 0x45,
+	PULLUP_DOWN_ENABLE_0		= 0x46,
+	PULLUP_DOWN_ENABLE_1		= 0x47,
+	PULLUP_DOWN_SELECTION_0		= 0x48,
+	PULLUP_DOWN_SELECTION_1		= 0x49,
+	INTERRUPT_MASK_0		= 0x4A,
+	INTERRUPT_MASK_1		= 0x4B,
+	INTERRUPT_STATUS_0		= 0x4C,
+	INTERRUPT_STATUS_1		= 0x4D,
+
+	OUTPUT_PORT_CONFIG		= 0x4F,
+	INTERRUPT_EDGE_0A		= 0x50,
+	INTERRUPT_EDGE_0B		= 0x51,
+	INTERRUPT_EDGE_1A		= 0x52,
+	INTERRUPT_EDGE_1B		= 0x53,
+	INTERRUPT_CLEAR_0		= 0x54,
+	INTERRUPT_CLEAR_1		= 0x55,
+	INPUT_STATUS_0			= 0x56,
+	INPUT_STATUS_1			= 0x57,
+	INDIVIDUAL_PIN_OUTPUT_0		= 0x58,
+	INDIVIDUAL_PIN_OUTPUT_1		= 0x59,
+	SWITCH_DEBOUNCE_ENABLE		= 0x5A,
+	NUM_REGS			= 0x5B,
+};
+
+/* Transfer paths, in order of preference for multi-register accesses */
+enum Xfer : uint8_t {
+	XFER_BYTE,		/* One SMBus byte access per register */
+	XFER_SMBUS_WORD,	/* Port pairs only */
+	XFER_SMBUS_BLOCK,
+	XFER_RAW,		/* Plain I2C messages (I2C_RDWR) */
+	XFER_NUM,
+};
+
+const char *xferName(Xfer path);
+
+/* Register model shared with the replay tool */
+void loadDefaults(uint8_t *regs);	/* Power-on values, NUM_REGS bytes */
+bool isVolatile(uint8_t reg);
+
+/* Bus traffic, one transfer is one ioctl on the i2c-dev node */
+struct Stats {
+	uint64_t transfers = 0;
+	uint64_t messages = 0;
+	uint64_t bytes = 0;
+};
+
+class Device;
+
+/*
+ * Register accesses collected and issued as one I2C_RDWR transfer (split at
+ * the i2c-dev message limit). Without plain I2C support on the adapter the
+ * accesses are issued one by one. Read buffers are filled by commit().
+ */
+class Batch {
+public:
+	explicit Batch(Device &dev) : dev_(dev) {}
+
+	Batch &read(uint8_t reg, uint8_t *buf, uint8_t len);
+	Batch &write(uint8_t reg, const uint8_t *buf, uint8_t len);
+	Batch &read16(uint8_t reg, uint16_t *val);
+	Batch &write16(uint8_t reg, uint16_t val);
+
+	int commit();
+	size_t size() const { return ops_.size(); }
+
+private:
+	struct Op {
+		uint8_t reg;
+		uint8_t len;
+		bool read;
+		uint8_t *dst;
+		uint16_t *dst16;
+		uint8_t data[NUM_REGS + 1];	/* Register address, then payload */
+	};
+
+	Device &dev_;
+	std::vector<Op> ops_;
+};
+
+class Device {
+public:
+	Device();
+	~Device();
+	Device(const Device &) = delete;
+	Device &operator=(const Device &) = delete;
+
+	/* bus is "/dev/i2c-N", addr the 7-bit address (0x20-0x23) */
+	int open(const std::string &bus, uint8_t addr);
+	void close();
+
+	/*
+	 * Reset the chip with the general call software reset and load the
+	 * power-on values into the shadow. Resets every chip on the bus that
+	 * answers general calls.
+	 */
+	int reset();
+	/* Adopt the chip's current state instead: read all writable registers */
+	int syncFromChip();
+
+	int readReg(uint8_t reg, uint8_t *val);
+	int writeReg(uint8_t reg, uint8_t val);
+	int readBlock(uint8_t reg, uint8_t len, uint8_t *buf);
+	int writeBlock(uint8_t reg, uint8_t len, const uint8_t *buf);
+	/* Read-modify-write from the shadow, no bus access if nothing changes */
+	int updateBits(uint8_t reg, uint8_t mask, uint8_t val);
+
+	/* 16-bit port operations, bit n = line n */
+	int readInputs(uint16_t *val);
+	int setOutputs(uint16_t mask, uint16_t val);
+	int setDirection(uint16_t mask, uint16_t inputs);
+	int setPolarity(uint16_t mask, uint16_t inverted);
+	int setPull(uint16_t mask, uint16_t enable, uint16_t up);
+	int setOpenDrain(uint16_t mask, uint16_t open_drain);
+	int setInterruptMask(uint16_t mask, uint16_t masked);
+
+	/*
+	 * Interrupts through the host GPIO line wired to INT (active low).
+	 * waitInterrupt() returns 0 with *status == 0 on timeout; otherwise
+	 * the status and input ports are read in one transfer and the status
+	 * is cleared, as in the driver's interrupt handler.
+	 */
+	int attachInterrupt(const std::string &gpiochip, unsigned int line);
+	int waitInterrupt(int timeout_ms, uint16_t *status, uint16_t *input);
+
+	uint8_t cached(uint8_t reg) const { return cache_[reg]; }
+	Xfer path(uint8_t len) const;
+	bool rawI2c() const { return raw_; }
+	const Stats &stats() const { return stats_; }
+	void resetStats() { stats_ = Stats(); }
+
+private:
+	friend class Batch;
+
+	int port16(uint8_t reg, uint16_t mask, uint16_t val);
+	void cacheUpdate(uint8_t reg, uint8_t len, const uint8_t *buf);
+	int rdwr(struct i2c_msg *msgs, unsigned int n);
+	int smbus(uint8_t rw, uint8_t cmd, int size, union i2c_smbus_data *data);
+	int xferRead(Xfer path, uint8_t reg, uint8_t len, uint8_t *buf);
+	int xferWrite(Xfer path, uint8_t reg, uint8_t len, const uint8_t *buf);
+
+	int fd_;
+	int irq_fd_;
+	uint8_t addr_;
+	bool raw_;
+	uint32_t supported_;
+	uint8_t cache_[NUM_REGS];
+	Stats stats_;
+};
+
+} /* namespace kts1622 */
+
+#endif /* KTS1622_HPP */
@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/**
+ * @file kts1622_replay.cpp
+ * @brief Replays a bus trace of the kernel driver against a register model.
+ *
+ * The driver records its transfers when tracing is enabled in debugfs:
+ * @code
+ * $ echo 1 | sudo tee /sys/kernel/debug/kts1622/trace_enable
+ * $ echo | sudo tee /sys/kernel/debug/kts1622/trace        # empty the ring
+ * $ ... run the workload ...
+ * $ sudo cat /sys/kernel/debug/kts1622/trace > new.trace
+ * @endcode
+ * The tool then reports, per caller class, the transfers, messages and bytes,
+ * the measured bus time, and the wire time at a given SCL rate. It also
+ * reports writes that did not change the modelled register and reads of
+ * registers the driver shadows. Both show extra work on a hot path, such as
+ * a read-modify-write that no longer comes from the cache.
+ * @code
+ * $ ./kts1622_replay [--scl HZ] new.trace              # report
+ * $ ./kts1622_replay [--scl HZ] old.trace new.trace    # compare, exit 2 on regression
+ * @endcode
+ */
+#include "kts1622.hpp"
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+using namespace kts1622;
+
+struct Counts {
+	uint64_t transfers = 0;
+	uint64_t messages = 0;
+	uint64_t bytes = 0;		/* On the wire, address bytes included */
+	uint64_t bus_ns = 0;		/* As measured by the driver */
+	uint64_t redundant_writes = 0;	/* Registers written with their value */
+	uint64_t cached_reads = 0;	/* Reads of registers the driver shadows */
+	uint64_t errors = 0;
+
+	void add(const Counts &c)
+	{
+		transfers += c.transfers;
+		messages += c.messages;
+		bytes += c.bytes;
+		bus_ns += c.bus_ns;
+		redundant_writes += c.redundant_writes;
+		cached_reads += c.cached_reads;
+		errors += c.errors;
+	}
+};
+
+struct Report {
+	std::map<std::string, Counts> classes;
+	Counts total;
+	uint64_t entries = 0;
+	uint64_t mismatches = 0;	/* Reads that disagreed with the model */
+};
+
+static int hexval(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+static int replay(const char *file, Report &r)
+{
+	std::map<unsigned int, std::array<uint8_t, NUM_REGS>> model;
+	std::ifstream in(file);
+	std::string line;
+	int lineno = 0;
+
+	if (!in) {
+		fprintf(stderr, "%s: cannot open\n", file);
+		return -1;
+	}
+
+	while (std::getline(in, line)) {
+		std::string cls, path, dir, data;
+		unsigned int addr, reg, len, cont;
+		uint64_t ts, dur;
+		uint8_t bytes[NUM_REGS] = {};
+		unsigned int nbytes = 0;
+		bool read;
+		int ret;
+		Counts c;
+
+		lineno++;
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		std::istringstream ss(line);
+		ss >> ts >> dur >> cls >> path >> std::hex >> addr >> dir >> std::dec
+		   >> cont >> std::hex >> reg >> std::dec >> len >> data >> ret;
+		if (!ss || reg >= NUM_REGS) {
+			fprintf(stderr, "%s:%d: malformed entry\n", file, lineno);
+			return -1;
+		}
+		read = dir == "R";
+
+		if (data != "-")
+			for (size_t i = 0; i + 1 < data.size() && nbytes < NUM_REGS; i += 2)
+				bytes[nbytes++] = hexval(data[i]) << 4 | hexval(data[i + 1]);
+
+		/* SMBus byte accesses are one transfer per register */
+		if (path == xferName(XFER_BYTE)) {
+			c.transfers = len;
+			c.messages = len * (read ? 2 : 1);
+			c.bytes = len * (read ? 4 : 3);
+		} else {
+			c.transfers = cont ? 0 : 1;
+			c.messages = read ? 2 : 1;
+			c.bytes = read ? 3 + len : 2 + len;
+		}
+		c.bus_ns = dur;
+		if (ret < 0)
+			c.errors = 1;
+
+		if (!model.count(addr)) {
+			std::array<uint8_t, NUM_REGS> regs;
+
+			loadDefaults(regs.data());
+			model[addr] = regs;
+		}
+
+		auto &regs = model[addr];
+
+		for (unsigned int i = 0; ret >= 0 && i < nbytes && reg + i < NUM_REGS; i++) {
+			uint8_t a = reg + i;
+
+			if (isVolatile(a))
+				continue;
+			if (read) {
+				c.cached_reads++;
+				if (regs[a] != bytes[i])
+					r.mismatches++;
+			} else if (regs[a] == bytes[i]) {
+				c.redundant_writes++;
+			}
+			regs[a] = bytes[i];
+		}
+
+		r.classes[cls].add(c);
+		r.total.add(c);
+		r.entries++;
+	}
+
+	return 0;
+}
+
+static double wire_us(const Counts &c, unsigned long scl)
+{
+	/* Nine clocks per byte, plus start/repeated start and stop */
+	return (c.bytes * 9.0 + c.messages + c.transfers) * 1e6 / scl;
+}
+
+static void print_row(const char *name, const Counts &c, unsigned long scl)
+{
+	printf("%-8s %10llu %10llu %10llu %12.1f %12.1f %10llu %10llu %7llu\n", name,
+	       (unsigned long long)c.transfers, (unsigned long long)c.messages,
+	       (unsigned long long)c.bytes, c.bus_ns / 1000.0, wire_us(c, scl),
+	       (unsigned long long)c.redundant_writes,
+	       (unsigned long long)c.cached_reads, (unsigned long long)c.errors);
+}
+
+static void print_report(const char *file, const Report &r, unsigned long scl)
+{
+	printf("%s: %llu entries, %llu reads disagreed with the model\n", file,
+	       (unsigned long long)r.entries, (unsigned long long)r.mismatches);
+	printf("%-8s %10s %10s %10s %12s %12s %10s %10s %7s\n", "class",
+	       "transfers", "messages", "bytes", "bus_us", "wire_us", "redundant",
+	       "shadowed", "errors");
+	for (const auto &it : r.classes)
+		print_row(it.first.c_str(), it.second, scl);
+	print_row("total", r.total, scl);
+}
+
+static bool compare(const Report &old_r, const Report &new_r)
+{
+	bool regressed = false;
+
+	printf("\nchange (new - old):\n");
+	for (const auto &it : new_r.classes) {
+		auto o = old_r.classes.find(it.first);
+		Counts prev = o == old_r.classes.end() ? Counts() : o->second;
+		long long dt = it.second.transfers - prev.transfers;
+		long long dw = it.second.redundant_writes - prev.redundant_writes;
+		long long dr = it.second.cached_reads - prev.cached_reads;
+
+		printf("%-8s transfers %+lld, redundant writes %+lld, shadowed reads %+lld\n",
+		       it.first.c_str(), dt, dw, dr);
+		regressed |= dt > 0 || dw > 0 || dr > 0;
+	}
+
+	return regressed;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long scl = 400000;
+	Report reports[2];
+	int nfiles = 0;
+	const char *files[2];
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--scl") && i + 1 < argc)
+			scl = strtoul(argv[++i], NULL, 0);
+		else if (nfiles < 2)
+			files[nfiles++] = argv[i];
+	}
+
+	if (!nfiles || !scl) {
+		fprintf(stderr, "usage: %s [--scl HZ] trace [new-trace]\n", argv[0]);
+		return 1;
+	}
+
+	for (i = 0; i < nfiles; i++) {
+		if (replay(files[i], reports[i]) < 0)
+			return 1;
+		print_report(files[i], reports[i], scl);
+	}
+
+	if (nfiles == 2 && compare(reports[0], reports[1])) {
+		printf("regression: more bus work than %s\n", files[0]);
+		return 2;
+	}
+
+	return 0;
+}
@@ -0,0 +1,50 @@
+#!/bin/bash
+# Runs test_reflex, test_wait_pattern and test_stress against the simulated
+# adapter of i2c-kts1622-sim.ko, no hardware needed. Build the modules in
+# src/drivers and the tests ("make") first, or run "make sim".
+DRIVERS=${DRIVERS:-../src/drivers}
+failed=0
+
+cleanup() {
+	sudo rmmod i2c-kts1622-sim 2>/dev/null
+	sudo rmmod gpio-kts1622 2>/dev/null
+}
+trap cleanup EXIT
+
+lsmod | grep -q '^gpio_kts1622 ' || sudo insmod $DRIVERS/gpio-kts1622.ko || exit 1
+# Lines 14 and 15 are the loopback pair of test_stress, 0 and 1 stay unwired.
+sudo insmod $DRIVERS/i2c-kts1622-sim.ko wire=14,15 byte_us=23 || exit 1
+udevadm settle
+
+bus=
+for adapter in /sys/bus/i2c/devices/i2c-*; do
+	grep -qx "KTS1622 simulated adapter" $adapter/name && bus=${adapter##*-}
+done
+dev=/sys/bus/i2c/devices/$bus-0020
+chip=$(ls -d $dev/gpiochip* 2>/dev/null | head -1)
+if [ -z "$bus" ] || [ -z "$chip" ]; then
+	echo "Simulated chip not found"
+	exit 1
+fi
+chip=$(basename $chip)
+echo "Simulated chip: $chip on i2c-$bus"
+
+echo "== test_reflex"
+sudo ./test_reflex $chip $dev 0 1 || failed=1
+
+echo "== test_wait_pattern"
+# Line 3 is an undriven input, its level comes from the simulation.
+echo 0x0000 | sudo tee /sys/kernel/debug/kts1622-sim/ext > /dev/null
+sudo ./test_wait_pattern /dev/kts1622-$bus-0020 0x0008 0x0008 2000 1 > wait.log &
+sleep 0.5
+echo 0x0008 | sudo tee /sys/kernel/debug/kts1622-sim/ext > /dev/null
+wait $! || failed=1
+cat wait.log
+grep -q '^Match' wait.log || failed=1
+rm -f wait.log
+
+echo "== test_stress"
+sudo ./test_stress $chip 4 2 14:15 || failed=1
+
+[ $failed -eq 0 ] && echo "PASS" || echo "FAIL"
+exit $failed
@@ -0,0 +1,196 @@
+/**
+ * @file test_reflex.c
+ * @brief A program to check that a reflex rule acts on an input that is already asserted.
+ *
+ * A rule must drive its outputs as soon as it is stored, not only on the next
+ * edge of its inputs, otherwise an interlock stays open until the input moves.
+ *
+ * The program performs the following steps:
+ * 1. Requests OUT as an output at 0 and IN as an input with pull-up, so IN is
+ *    high (asserted) before any rule exists. Nothing may be wired to IN.
+ * 2. Stores rule 7 "OUT follows IN" and reads OUT back right away, without any
+ *    edge on IN. OUT must be 1.
+ * 3. Releases both lines and waits past the runtime PM autosuspend delay. With
+ *    kinetic_technologies,runtime-pm the stored rule alone must keep the chip
+ *    active, otherwise its interrupt is gated and the rule stops acting.
+ * 4. Requests the lines again, OUT as-is so its level is kept, and switches IN
+ *    to pull-down. The edge runs the rule in the interrupt handler and OUT
+ *    must go back to 0.
+ * 5. Removes the rule, releases the lines and, with runtime PM, checks that
+ *    the chip suspends again after the delay.
+ *
+ * To compile the program:
+ * @code
+ * $ gcc test_reflex.c -o test_reflex -lgpiod
+ * @endcode
+ * Usage:
+ * @code
+ * $ sudo ./test_reflex gpiochip2 /sys/bus/i2c/devices/1-0020 IN OUT
+ * @endcode
+ * @note This program requires libgpiod 1.6 or later (gpiod_line_set_flags) and
+ * a chip with its interrupt configured.
+ */
+#include <gpiod.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CONSUMER    "reflex"
+#define RULE        7
+#define IDLE_US     1500000     /* Past the 1 s autosuspend delay */
+
+static int write_rule(const char *dev, const char *rule)
+{
+    char path[256];
+    FILE *f;
+    int ret;
+
+    snprintf(path, sizeof(path), "%s/reflex", dev);
+    f = fopen(path, "w");
+    if (!f) {
+        perror("Open reflex failed");
+        return -1;
+    }
+    ret = fprintf(f, "%s\n", rule);
+    if (fclose(f) != 0 || ret < 0) {
+        perror("Write reflex failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Runtime PM state of the device, skipped without kinetic_technologies,runtime-pm
+static int check_pm(const char *dev, const char *expected, const char *step)
+{
+    char path[256];
+    char state[32] = "";
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/power/runtime_status", dev);
+    f = fopen(path, "r");
+    if (!f || !fgets(state, sizeof(state), f)) {
+        perror("Read runtime_status failed");
+        if (f)
+            fclose(f);
+        return -1;
+    }
+    fclose(f);
+    state[strcspn(state, "\n")] = '\0';
+
+    if (!strcmp(state, "unsupported")) {
+        printf("%s: runtime PM not enabled, skipped\n", step);
+        return 0;
+    }
+
+    printf("%s: runtime PM %s, expected %s: %s\n", step, state, expected,
+           strcmp(state, expected) ? "FAIL" : "PASS");
+
+    return strcmp(state, expected) ? -1 : 0;
+}
+
+static int check(struct gpiod_line *line, int expected, const char *step)
+{
+    int value = gpiod_line_get_value(line);
+
+    printf("%s: OUT = %d, expected %d: %s\n", step, value, expected,
+           value == expected ? "PASS" : "FAIL");
+
+    return value == expected ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    struct gpiod_chip *chip;
+    struct gpiod_line *in;
+    struct gpiod_line *out;
+    struct gpiod_line_request_config as_is = {
+        .consumer = CONSUMER,
+        .request_type = GPIOD_LINE_REQUEST_DIRECTION_AS_IS,
+    };
+    unsigned int in_off;
+    unsigned int out_off;
+    char rule[64];
+    int failed = 0;
+
+    if (argc < 5) {
+        fprintf(stderr, "usage: %s gpiochipN /sys/bus/i2c/devices/<device> IN OUT\n",
+                argv[0]);
+        return 1;
+    }
+    in_off = atoi(argv[3]);
+    out_off = atoi(argv[4]);
+
+    chip = gpiod_chip_open_by_name(argv[1]);
+    if (!chip) {
+        perror("Open chip failed");
+        return 1;
+    }
+
+    in = gpiod_chip_get_line(chip, in_off);
+    out = gpiod_chip_get_line(chip, out_off);
+    if (!in || !out) {
+        perror("Get line failed");
+        gpiod_chip_close(chip);
+        return 1;
+    }
+
+    if (gpiod_line_request_output(out, CONSUMER, 0) < 0 ||
+        gpiod_line_request_input_flags(in, CONSUMER,
+                                       GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_UP) < 0) {
+        perror("Request lines failed");
+        gpiod_chip_close(chip);
+        return 1;
+    }
+
+    /* Let the pull-up settle, its edge comes before the rule exists. */
+    usleep(20000);
+    failed |= check(out, 0, "Before the rule");
+
+    snprintf(rule, sizeof(rule), "%d %04x %04x %04x %04x 0000", RULE,
+             1u << in_off, 1u << in_off, 1u << out_off, 1u << out_off);
+    if (write_rule(argv[2], rule) < 0) {
+        gpiod_chip_close(chip);
+        return 1;
+    }
+    /* No edge on IN since the rule was stored. */
+    failed |= check(out, 1, "Rule stored, IN asserted");
+
+    /* The pull-up and OUT's level stay in the chip after the release. */
+    gpiod_line_release(in);
+    gpiod_line_release(out);
+    usleep(IDLE_US);
+    failed |= check_pm(argv[2], "active", "Only the rule in use");
+
+    if (gpiod_line_request(out, &as_is, 0) < 0 ||
+        gpiod_line_request_input_flags(in, CONSUMER,
+                                       GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_UP) < 0) {
+        perror("Request lines again failed");
+        failed = -1;
+    } else {
+        failed |= check(out, 1, "After the autosuspend delay");
+
+        if (gpiod_line_set_flags(in, GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_DOWN) < 0) {
+            perror("Set pull-down failed");
+            failed = -1;
+        } else {
+            usleep(20000);
+            failed |= check(out, 0, "IN released");
+        }
+    }
+
+    snprintf(rule, sizeof(rule), "%d off", RULE);
+    write_rule(argv[2], rule);
+
+    if (gpiod_line_is_requested(in))
+        gpiod_line_release(in);
+    if (gpiod_line_is_requested(out))
+        gpiod_line_release(out);
+    usleep(IDLE_US);
+    failed |= check_pm(argv[2], "suspended", "Rule removed");
+
+    gpiod_chip_close(chip);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,422 @@
+/**
+ * @file test_stress.c
+ * @brief A concurrency stress test of the driver using the libgpiod library.
+ *
+ * Worker threads hammer the chip with line requests, output sets, input reads,
+ * direction and bias changes, and event request/release, while an optional
+ * loopback pair keeps interrupts firing. This runs the i2c_lock, the irq_lock
+ * bus lock and the interrupt handler against each other.
+ *
+ * The program performs the following steps:
+ * 1. Opens the GPIO chip given on the command line (see 'gpiodetect').
+ * 2. For 1, 2, 4, ... up to the given number of threads, runs the workload for
+ *    the given time. Each thread owns the lines whose number modulo the thread
+ *    count is its index.
+ * 3. Prints the operations per second and the scaling relative to one thread,
+ *    and the output read-back mismatches.
+ * 4. With a loopback pair (OUT wired to IN), one thread toggles OUT and another
+ *    counts the edge events on IN. Lost events are reported.
+ * 5. Every thread leaves its lines as outputs with a known pattern. The output
+ *    and configuration registers from /sys/kernel/debug/gpio are compared with
+ *    that pattern.
+ *
+ * To compile the program:
+ * @code
+ * $ gcc test_stress.c -o test_stress -lgpiod -lpthread
+ * @endcode
+ * Usage:
+ * @code
+ * $ sudo ./test_stress gpiochip2 [max_threads] [seconds] [OUT:IN]
+ * @endcode
+ * Without hardware, run it on the simulated adapter, with the loopback pair
+ * wired in the simulation (see src/README.md):
+ * @code
+ * $ sudo insmod i2c-kts1622-sim.ko wire=14,15 byte_us=23
+ * $ sudo ./test_stress gpiochipN 8 5 14:15
+ * @endcode
+ * @note This program requires libgpiod 1.5 or later (bias flags) and debugfs
+ * for the register check. Do not run it with loads connected, every line
+ * that is not the loopback input is driven as an output.
+ */
+#include <gpiod.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CONSUMER                "stress"
+#define MAX_LINES               16
+#define MAX_THREADS             16
+#define SET_GET_ROUNDS          8
+
+struct worker {
+    pthread_t           thread;
+    int                 index;
+    unsigned int        offsets[MAX_LINES];
+    int                 num;
+    unsigned long long  ops;
+    unsigned long long  mismatches;
+    unsigned long long  errors;
+    unsigned int        seed;
+};
+
+static const char       *chip_name;
+static volatile int     running;
+static int              loop_out = -1;
+static int              loop_in = -1;
+static pthread_barrier_t final_barrier;
+static pthread_barrier_t checked_barrier;
+static int              final_check;
+
+// Final level of a line, different per line so swapped lines are caught
+static int final_value(unsigned int offset)
+{
+    return (0x5A3C >> offset) & 1;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int request_bulk(struct gpiod_chip *chip, struct worker *w,
+                        struct gpiod_line_bulk *bulk)
+{
+    return gpiod_chip_get_lines(chip, w->offsets, w->num, bulk);
+}
+
+// One round: outputs with read-back, inputs with bias, events on and off
+static void worker_round(struct worker *w, struct gpiod_line_bulk *bulk)
+{
+    int vals[MAX_LINES];
+    int back[MAX_LINES];
+    int i, r;
+
+    for (i = 0; i < w->num; i++)
+        vals[i] = rand_r(&w->seed) & 1;
+    if (gpiod_line_request_bulk_output(bulk, CONSUMER, vals) < 0) {
+        w->errors++;
+        return;
+    }
+    w->ops++;
+
+    for (r = 0; r < SET_GET_ROUNDS; r++) {
+        for (i = 0; i < w->num; i++)
+            vals[i] = rand_r(&w->seed) & 1;
+        if (gpiod_line_set_value_bulk(bulk, vals) < 0 ||
+            gpiod_line_get_value_bulk(bulk, back) < 0) {
+            w->errors++;
+            break;
+        }
+        w->ops += 2;
+        for (i = 0; i < w->num; i++)
+            if (back[i] != vals[i])
+                w->mismatches++;
+    }
+    gpiod_line_release_bulk(bulk);
+
+    if (gpiod_line_request_bulk_input_flags(bulk, CONSUMER,
+            (w->seed & 1) ? GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_UP :
+                            GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_DOWN) < 0 ||
+        gpiod_line_get_value_bulk(bulk, back) < 0)
+        w->errors++;
+    else
+        w->ops += 2;
+    gpiod_line_release_bulk(bulk);
+
+    if (gpiod_line_request_bulk_both_edges_events(bulk, CONSUMER) < 0)
+        w->errors++;
+    else
+        w->ops++;
+    gpiod_line_release_bulk(bulk);
+}
+
+// Leave the lines as outputs with their final values and wait for the check
+static void worker_final(struct worker *w, struct gpiod_line_bulk *bulk)
+{
+    int vals[MAX_LINES];
+    int i;
+
+    for (i = 0; i < w->num; i++)
+        vals[i] = final_value(w->offsets[i]);
+    if (gpiod_line_request_bulk_output(bulk, CONSUMER, vals) < 0)
+        w->errors++;
+
+    pthread_barrier_wait(&final_barrier);
+    pthread_barrier_wait(&checked_barrier);
+    gpiod_line_release_bulk(bulk);
+}
+
+static void *worker_thread(void *arg)
+{
+    struct worker *w = arg;
+    struct gpiod_line_bulk bulk;
+    struct gpiod_chip *chip;
+
+    // One chip handle per thread, like independent processes
+    chip = gpiod_chip_open_by_name(chip_name);
+    if (!chip || request_bulk(chip, w, &bulk) < 0) {
+        perror("Open chip failed");
+        w->errors++;
+        if (final_check) {
+            pthread_barrier_wait(&final_barrier);
+            pthread_barrier_wait(&checked_barrier);
+        }
+        return NULL;
+    }
+
+    while (running)
+        worker_round(w, &bulk);
+
+    if (final_check)
+        worker_final(w, &bulk);
+
+    gpiod_chip_close(chip);
+    return NULL;
+}
+
+static unsigned long long toggles;
+static unsigned long long events;
+
+static void *toggle_thread(void *arg)
+{
+    struct gpiod_line *line = arg;
+    int val = 0;
+
+    while (running) {
+        val = !val;
+        if (gpiod_line_set_value(line, val) < 0)
+            break;
+        toggles++;
+        usleep(200);
+    }
+    return NULL;
+}
+
+static void *event_thread(void *arg)
+{
+    struct gpiod_line *line = arg;
+    struct gpiod_line_event event;
+    struct timespec timeout = { 0, 100000000 };
+
+    // Keep reading after the toggler stopped until the line is quiet
+    for (;;) {
+        if (gpiod_line_event_wait(line, &timeout) <= 0) {
+            if (!running)
+                break;
+            continue;
+        }
+        if (gpiod_line_event_read(line, &event) == 0)
+            events++;
+    }
+    return NULL;
+}
+
+// Parse OUTPUT_0/1 (0x02/0x03) and CONFIG_0/1 (0x06/0x07) of the chip
+static int read_regs(const char *name, unsigned int *output, unsigned int *config)
+{
+    char line[256];
+    char header[64];
+    int in_chip = 0;
+    int found = 0;
+    FILE *f;
+
+    f = fopen("/sys/kernel/debug/gpio", "r");
+    if (!f)
+        return -1;
+
+    snprintf(header, sizeof(header), "%s:", name);
+    *output = 0;
+    *config = 0;
+    while (fgets(line, sizeof(line), f)) {
+        unsigned int reg, val;
+
+        if (!strncmp(line, "gpiochip", 8)) {
+            in_chip = !strncmp(line, header, strlen(header));
+            continue;
+        }
+        if (!in_chip || sscanf(line, " 0x%x: 0x%x", &reg, &val) != 2)
+            continue;
+        if (reg == 0x02 || reg == 0x03)
+            *output |= val << ((reg - 0x02) * 8);
+        else if (reg == 0x06 || reg == 0x07)
+            *config |= val << ((reg - 0x06) * 8);
+        else
+            continue;
+        found++;
+    }
+    fclose(f);
+
+    return found == 4 ? 0 : -1;
+}
+
+static int check_final(int nlines)
+{
+    unsigned int output, config;
+    int failed = 0;
+
+    if (read_regs(chip_name, &output, &config) < 0) {
+        printf("Register check skipped (no registers in /sys/kernel/debug/gpio)\n");
+        return 0;
+    }
+
+    for (int i = 0; i < nlines; i++) {
+        if (i == loop_in || i == loop_out)
+            continue;
+        if (config & (1u << i)) {
+            printf("line %d: input in CONFIG, expected output\n", i);
+            failed++;
+        } else if (((output >> i) & 1) != (unsigned int)final_value(i)) {
+            printf("line %d: OUTPUT %u, expected %d\n", i, (output >> i) & 1,
+                   final_value(i));
+            failed++;
+        }
+    }
+    printf("Register check: %s (OUTPUT 0x%04x, CONFIG 0x%04x)\n",
+           failed ? "FAILED" : "ok", output, config);
+
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    static struct worker workers[MAX_THREADS];
+    struct gpiod_line *out_line = NULL, *in_line = NULL;
+    pthread_t toggler, event_reader;
+    struct gpiod_chip *chip;
+    double base = 0;
+    int max_threads = 8;
+    int seconds = 5;
+    int nlines;
+    int failed = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s gpiochipN [max_threads] [seconds] [OUT:IN]\n",
+                argv[0]);
+        return 1;
+    }
+    chip_name = argv[1];
+    if (argc > 2)
+        max_threads = atoi(argv[2]);
+    if (argc > 3)
+        seconds = atoi(argv[3]);
+    if (argc > 4 && sscanf(argv[4], "%d:%d", &loop_out, &loop_in) != 2) {
+        fprintf(stderr, "loopback pair must be OUT:IN\n");
+        return 1;
+    }
+
+    chip = gpiod_chip_open_by_name(chip_name);
+    if (!chip) {
+        perror("Open chip failed");
+        return 1;
+    }
+    nlines = gpiod_chip_num_lines(chip);
+    if (nlines > MAX_LINES)
+        nlines = MAX_LINES;
+    if (max_threads < 1 || max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+    if (max_threads > nlines - (loop_out >= 0 ? 2 : 0))
+        max_threads = nlines - (loop_out >= 0 ? 2 : 0);
+
+    if (loop_out >= 0) {
+        out_line = gpiod_chip_get_line(chip, loop_out);
+        in_line = gpiod_chip_get_line(chip, loop_in);
+        if (!out_line || !in_line ||
+            gpiod_line_request_output(out_line, CONSUMER, 0) < 0 ||
+            gpiod_line_request_both_edges_events(in_line, CONSUMER) < 0) {
+            perror("Request loopback pair failed");
+            gpiod_chip_close(chip);
+            return 1;
+        }
+    }
+
+    printf("%-8s %14s %8s %12s %8s\n", "threads", "ops/s", "scaling",
+           "mismatches", "errors");
+
+    for (int n = 1; n <= max_threads; n *= 2) {
+        unsigned long long ops = 0, mismatches = 0, errors = 0;
+        int last = n * 2 > max_threads;
+        double start, elapsed;
+
+        // The last step leaves the lines to the register check
+        final_check = last;
+        if (last) {
+            pthread_barrier_init(&final_barrier, NULL, n + 1);
+            pthread_barrier_init(&checked_barrier, NULL, n + 1);
+        }
+
+        for (int t = 0; t < n; t++) {
+            struct worker *w = &workers[t];
+
+            memset(w, 0, sizeof(*w));
+            w->index = t;
+            w->seed = t * 7919 + 1;
+            for (int l = 0, k = 0; l < nlines; l++) {
+                if (l == loop_out || l == loop_in)
+                    continue;
+                if (k++ % n == t)
+                    w->offsets[w->num++] = l;
+            }
+        }
+
+        toggles = 0;
+        events = 0;
+        running = 1;
+        start = now_s();
+        for (int t = 0; t < n; t++)
+            pthread_create(&workers[t].thread, NULL, worker_thread, &workers[t]);
+        if (out_line) {
+            pthread_create(&toggler, NULL, toggle_thread, out_line);
+            pthread_create(&event_reader, NULL, event_thread, in_line);
+        }
+
+        sleep(seconds);
+        running = 0;
+        elapsed = now_s() - start;
+
+        if (last) {
+            pthread_barrier_wait(&final_barrier);
+            failed += check_final(nlines);
+            pthread_barrier_wait(&checked_barrier);
+        }
+
+        for (int t = 0; t < n; t++) {
+            pthread_join(workers[t].thread, NULL);
+            ops += workers[t].ops;
+            mismatches += workers[t].mismatches;
+            errors += workers[t].errors;
+        }
+        if (out_line) {
+            pthread_join(toggler, NULL);
+            pthread_join(event_reader, NULL);
+        }
+
+        if (n == 1)
+            base = ops / elapsed;
+        printf("%-8d %14.0f %7.2fx %12llu %8llu\n", n, ops / elapsed,
+               base ? ops / elapsed / base : 0, mismatches, errors);
+        if (out_line)
+            printf("         loopback: %llu toggles, %llu events, %lld lost\n",
+                   toggles, events, (long long)toggles - (long long)events);
+
+        failed += mismatches || errors;
+        if (last) {
+            pthread_barrier_destroy(&final_barrier);
+            pthread_barrier_destroy(&checked_barrier);
+        }
+    }
+
+    if (out_line) {
+        gpiod_line_release(out_line);
+        gpiod_line_release(in_line);
+    }
+    gpiod_chip_close(chip);
+
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file test_wait_pattern.c
+ * @brief A program to wait for a combination of inputs with KTS1622_IOC_WAIT_PATTERN.
+ *
+ * The driver compares the inputs with the pattern on every interrupt and only
+ * returns when they match, so the program wakes once per match instead of once
+ * per edge.
+ *
+ * The program performs the following steps:
+ * 1. Opens the wait-for-pattern device of the chip, e.g. /dev/kts1622-1-0020.
+ * 2. Waits until (inputs & mask) == value, up to the timeout.
+ * 3. Prints the matching input snapshot and the time from the interrupt that
+ *    read it to the return of the ioctl.
+ * 4. Repeats the given number of times. A pattern that still matches returns
+ *    again at once.
+ *
+ * To compile the program:
+ * @code
+ * $ gcc test_wait_pattern.c -I../src/drivers -o test_wait_pattern
+ * @endcode
+ * Usage (mask and value in hex, bit n is line n, physical levels):
+ * @code
+ * $ ./test_wait_pattern /dev/kts1622-1-0020 0x0003 0x0001 [timeout_ms] [count]
+ * @endcode
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kts1622.h"
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    struct kts1622_wait_pattern req;
+    unsigned long long ret_ns;
+    int timeout_ms = -1;
+    int count = 1;
+    int fd;
+
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s /dev/kts1622-N-ADDR mask value [timeout_ms] [count]\n",
+                argv[0]);
+        return 1;
+    }
+    if (argc > 4)
+        timeout_ms = atoi(argv[4]);
+    if (argc > 5)
+        count = atoi(argv[5]);
+
+    fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        perror("Open device failed");
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        memset(&req, 0, sizeof(req));
+        req.mask = strtoul(argv[2], NULL, 16);
+        req.value = strtoul(argv[3], NULL, 16);
+        req.timeout_ms = timeout_ms;
+
+        if (ioctl(fd, KTS1622_IOC_WAIT_PATTERN, &req) < 0) {
+            if (errno == ETIMEDOUT) {
+                printf("Timed out\n");
+                continue;
+            }
+            perror("Wait for pattern failed");
+            close(fd);
+            return 1;
+        }
+        ret_ns = now_ns();
+
+        printf("Match %d: inputs 0x%04x, %llu us after the interrupt\n", i,
+               req.input, (ret_ns - req.timestamp_ns) / 1000);
+    }
+
+    close(fd);
+    return 0;
+}